@@ -0,0 +1,113 @@
+// Compares the bucket queue and binary heap Dijkstra on the contracted graphs
+// of the separated two-qubit gates of a circuit, under the initial layout.
+//
+// gcc -O3 -pthread -I src bench/dijkstra_bench.c $(ls src/*.c | grep -v main.c) -o ./dijkstra-bench -lm
+// ./dijkstra-bench configs/default.json circuits/<circuit>.qasm devices/<device>.json [...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "circuit.h"
+#include "config.h"
+#include "device.h"
+#include "graph.h"
+#include "telesabre.h"
+#include "utils.h"
+
+#define BENCH_REPETITIONS 2000
+// Added to every inter-core edge in the second pass, so that keys leave the bucket window
+#define BENCH_HEAVY_TRAFFIC 100
+
+
+typedef void (*dijkstra_fn_t)(const graph_t *graph, int src, int dst, dijkstra_scratch_t *scratch, path_t *path_out);
+
+
+// Total distance over all queries, checked between variants
+static long run_queries(telesabre_t *ts, const gate_t **gates, size_t num_gates, const int traffic[][3], size_t num_traffic,
+                        dijkstra_fn_t dijkstra, double *seconds_out) {
+    eval_scratch_t *eval = ts->eval;
+    size_t node_ids[2];
+    pqubit_t node_phys[2];
+    long total_distance = 0;
+    double seconds = 0.0;
+
+    for (size_t g = 0; g < num_gates; g++) {
+        graph_t *graph = telesabre_build_contracted_graph_for_pair(
+            ts, eval->contracted_graph, ts->layout, gates[g], node_ids, node_phys, traffic, num_traffic
+        );
+        double start = monotonic_seconds();
+        for (int r = 0; r < BENCH_REPETITIONS; r++)
+            dijkstra(graph, node_ids[0], node_ids[1], eval->dijkstra, eval->path);
+        seconds += monotonic_seconds() - start;
+        total_distance += eval->path->distance;
+    }
+
+    *seconds_out = seconds;
+    return total_distance;
+}
+
+
+static void bench_device(const config_t *config, const circuit_t *circuit, const char *device_file) {
+    device_t *device = device_from_json(device_file);
+    telesabre_t *ts = telesabre_init(config, device, circuit);
+
+    const gate_t **gates = malloc(sizeof(gate_t *) * (circuit->num_gates + 1));
+    int (*traffic)[3] = malloc(sizeof(int[3]) * (device->num_intercore_edges + 1));
+    check_alloc(2, gates, traffic);
+
+    size_t num_gates = 0;
+    for (size_t i = 0; i < circuit->num_gates; i++) {
+        const gate_t *gate = &circuit->gates[i];
+        if (!gate_is_two_qubit(gate)) continue;
+        pqubit_t p1 = layout_get_phys(ts->layout, gate->target_qubits[0]);
+        pqubit_t p2 = layout_get_phys(ts->layout, gate->target_qubits[1]);
+        if (device->phys_to_core[p1] != device->phys_to_core[p2]) gates[num_gates++] = gate;
+    }
+
+    for (int e = 0; e < device->num_intercore_edges; e++) {
+        traffic[e][0] = device->inter_core_edges[e].p1;
+        traffic[e][1] = device->inter_core_edges[e].p2;
+        traffic[e][2] = BENCH_HEAVY_TRAFFIC;
+    }
+
+    printf("%s: %d comm qubits, %zu separated gates x %d repetitions\n",
+           device_file, device->num_comm_qubits, num_gates, BENCH_REPETITIONS);
+
+    for (int heavy = 0; heavy <= 1; heavy++) {
+        size_t num_traffic = heavy ? (size_t)device->num_intercore_edges : 0;
+        double heap_seconds, bucket_seconds;
+        long heap_total = run_queries(ts, gates, num_gates, traffic, num_traffic, graph_dijkstra_heap_into, &heap_seconds);
+        long bucket_total = run_queries(ts, gates, num_gates, traffic, num_traffic, graph_dijkstra_into, &bucket_seconds);
+
+        double queries = (double)num_gates * BENCH_REPETITIONS;
+        printf("  %-14s heap %8.1f ns/query   buckets %8.1f ns/query   speedup %.2fx   %s\n",
+               heavy ? "heavy traffic" : "no traffic",
+               heap_seconds * 1e9 / queries, bucket_seconds * 1e9 / queries,
+               bucket_seconds > 0 ? heap_seconds / bucket_seconds : 0.0,
+               heap_total == bucket_total ? "distances match" : RED "DISTANCES DIFFER" CRESET);
+    }
+
+    free(gates);
+    free(traffic);
+    telesabre_free(ts);
+    device_free(device);
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <config.json> <circuit.qasm> <device.json> [<device.json> ...]\n", argv[0]);
+        return 1;
+    }
+
+    config_t *config = config_from_json(argv[1]);
+    circuit_t *circuit = circuit_from_qasm(argv[2]);
+
+    for (int i = 3; i < argc; i++)
+        bench_device(config, circuit, argv[i]);
+
+    circuit_free(circuit);
+    config_free(config);
+    return 0;
+}
@@ -0,0 +1,289 @@
+// Times the primitive operations of the router on the initial layout of each
+// circuit and device: shortest paths on contracted graphs, heap updates, swaps,
+// teleports, layout copies, contracted graph builds and circuit slicing.
+// Circuits that do not fit a device are skipped. Allocations per operation are
+// reported when built with -DTS_COUNT_ALLOCATIONS.
+//
+// gcc -O3 -pthread -I src bench/micro_bench.c $(ls src/*.c | grep -v main.c) -o ./micro-bench -lm
+// ./micro-bench configs/default.json devices/<device>.json [...] circuits/<circuit>.qasm [...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_count.h"
+#include "circuit.h"
+#include "config.h"
+#include "device.h"
+#include "graph.h"
+#include "heap.h"
+#include "layout.h"
+#include "telesabre.h"
+#include "utils.h"
+
+// Each primitive is repeated until this many operations have been timed
+#define BENCH_MIN_OPS 200000
+
+
+typedef struct {
+    double start;
+    size_t allocs;
+} bench_mark_t;
+
+
+static bench_mark_t bench_start() {
+    bench_mark_t mark = { monotonic_seconds(), alloc_count_get() };
+    return mark;
+}
+
+
+static void bench_print(const char *name, double seconds, size_t allocs, size_t ops) {
+    if (ops == 0) {
+        printf("  %-28s none applicable\n", name);
+        return;
+    }
+    printf("  %-28s %10zu ops %10.1f ns/op", name, ops, seconds * 1e9 / ops);
+    if (alloc_count_supported())
+        printf(" %8.2f allocs/op\n", (double)allocs / ops);
+    else
+        printf(" %8s allocs/op\n", "n/a");
+}
+
+
+static void bench_report(const char *name, bench_mark_t mark, size_t ops) {
+    bench_print(name, monotonic_seconds() - mark.start, alloc_count_get() - mark.allocs, ops);
+}
+
+
+static size_t bench_rounds(size_t ops_per_round) {
+    return ops_per_round ? (BENCH_MIN_OPS + ops_per_round - 1) / ops_per_round : 0;
+}
+
+
+static void bench_dijkstra(telesabre_t *ts, const gate_t **gates, size_t num_gates) {
+    eval_scratch_t *eval = ts->eval;
+    size_t node_ids[2];
+    pqubit_t node_phys[2];
+    size_t rounds = bench_rounds(num_gates);
+    long checksum = 0;
+
+    bench_mark_t mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t g = 0; g < num_gates; g++) {
+            telesabre_build_contracted_graph_for_pair(ts, eval->contracted_graph, ts->layout, gates[g], node_ids, node_phys, NULL, 0);
+        }
+    }
+    bench_report("contracted_graph_for_pair", mark, rounds * num_gates);
+
+    // One graph per gate, built outside of the timed loops
+    graph_t **graphs = malloc(sizeof(graph_t *) * (num_gates + 1));
+    int (*endpoints)[2] = malloc(sizeof(int[2]) * (num_gates + 1));
+    check_alloc(2, graphs, endpoints);
+    for (size_t g = 0; g < num_gates; g++) {
+        graph_t *graph = telesabre_build_contracted_graph_for_pair(ts, eval->contracted_graph, ts->layout, gates[g], node_ids, node_phys, NULL, 0);
+        graphs[g] = graph_copy(graph);
+        endpoints[g][0] = node_ids[0];
+        endpoints[g][1] = node_ids[1];
+    }
+
+    mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t g = 0; g < num_gates; g++) {
+            path_t *path = graph_dijkstra(graphs[g], endpoints[g][0], endpoints[g][1]);
+            checksum += path->distance;
+            path_free(path);
+        }
+    }
+    bench_report("graph_dijkstra", mark, rounds * num_gates);
+
+    dijkstra_scratch_t *scratch = dijkstra_scratch_new(eval->contracted_graph->graph->num_nodes);
+    mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t g = 0; g < num_gates; g++) {
+            graph_dijkstra_into(graphs[g], endpoints[g][0], endpoints[g][1], scratch, eval->path);
+            checksum -= eval->path->distance;
+        }
+    }
+    bench_report("graph_dijkstra_into", mark, rounds * num_gates);
+
+    if (checksum != 0)
+        printf("  " RED "Dijkstra variants disagree on distances" CRESET "\n");
+
+    dijkstra_scratch_free(scratch);
+    for (size_t g = 0; g < num_gates; g++)
+        graph_free(graphs[g]);
+    free(graphs);
+    free(endpoints);
+}
+
+
+static void bench_heap(size_t num_items, rng_t *rng) {
+    heap_t *heap = heap_new(num_items);
+    int *priorities = malloc(sizeof(int) * num_items);
+    check_alloc(1, priorities);
+    for (size_t i = 0; i < num_items; i++)
+        priorities[i] = rng_next(rng) % 1024;
+
+    size_t rounds = bench_rounds(num_items);
+    double insert_seconds = 0.0, remove_seconds = 0.0;
+    size_t insert_allocs = 0, remove_allocs = 0;
+
+    for (size_t r = 0; r < rounds; r++) {
+        bench_mark_t mark = bench_start();
+        for (size_t i = 0; i < num_items; i++)
+            heap_insert(heap, (int)i, priorities[i]);
+        insert_seconds += monotonic_seconds() - mark.start;
+        insert_allocs += alloc_count_get() - mark.allocs;
+
+        // Remove in insertion order, so that most removals come from the middle of the heap
+        mark = bench_start();
+        for (size_t i = 0; i < num_items; i++)
+            heap_remove(heap, (int)i);
+        remove_seconds += monotonic_seconds() - mark.start;
+        remove_allocs += alloc_count_get() - mark.allocs;
+    }
+
+    bench_print("heap_insert", insert_seconds, insert_allocs, rounds * num_items);
+    bench_print("heap_remove", remove_seconds, remove_allocs, rounds * num_items);
+
+    free(priorities);
+    heap_free(heap);
+}
+
+
+static void bench_layout(telesabre_t *ts) {
+    const device_t *device = ts->device;
+    layout_t *layout = layout_copy(ts->layout);
+
+    // Swaps are applied twice, restoring the layout after every pair
+    size_t num_swaps = 0;
+    for (int e = 0; e < device->num_edges; e++) {
+        pqubit_t p1 = device->edges[e].p1, p2 = device->edges[e].p2;
+        if (!layout_is_phys_free(layout, p1) || !layout_is_phys_free(layout, p2)) num_swaps += 2;
+    }
+    size_t rounds = bench_rounds(num_swaps);
+    bench_mark_t mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        for (int e = 0; e < device->num_edges; e++) {
+            pqubit_t p1 = device->edges[e].p1, p2 = device->edges[e].p2;
+            if (layout_is_phys_free(layout, p1) && layout_is_phys_free(layout, p2)) continue;
+            layout_apply_swap(layout, p1, p2);
+            layout_apply_swap(layout, p1, p2);
+        }
+    }
+    bench_report("layout_apply_swap", mark, rounds * num_swaps);
+
+    // Teleports valid under the initial layout, each followed by the one back
+    size_t num_teleports = 0;
+    for (int e = 0; e < device->num_tp_edges; e++) {
+        const device_tp_edge_t *tp = &device->tp_edges[e];
+        if (!layout_is_phys_free(layout, tp->p_source) && layout_is_phys_free(layout, tp->p_mediator) &&
+            layout_is_phys_free(layout, tp->p_target)) num_teleports += 2;
+    }
+    rounds = bench_rounds(num_teleports);
+    mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        for (int e = 0; e < device->num_tp_edges; e++) {
+            const device_tp_edge_t *tp = &device->tp_edges[e];
+            if (layout_is_phys_free(layout, tp->p_source) || !layout_is_phys_free(layout, tp->p_mediator) ||
+                !layout_is_phys_free(layout, tp->p_target)) continue;
+            layout_apply_teleport(layout, tp->p_source, tp->p_mediator, tp->p_target);
+            layout_apply_teleport(layout, tp->p_target, tp->p_mediator, tp->p_source);
+        }
+    }
+    bench_report("layout_apply_teleport", mark, rounds * num_teleports);
+
+    rounds = BENCH_MIN_OPS / 10;
+    mark = bench_start();
+    for (size_t r = 0; r < rounds; r++)
+        layout_free(layout_copy(ts->layout));
+    bench_report("layout_copy + layout_free", mark, rounds);
+
+    mark = bench_start();
+    for (size_t r = 0; r < rounds; r++)
+        layout_copy_into(layout, ts->layout);
+    bench_report("layout_copy_into", mark, rounds);
+
+    layout_free(layout);
+}
+
+
+static void bench_slicing(telesabre_t *ts) {
+    size_t rounds = BENCH_MIN_OPS / 100;
+    bench_mark_t mark = bench_start();
+    for (size_t r = 0; r < rounds; r++) {
+        ts->slices_outdated = true;
+        telesabre_slice_remaining_circuit(ts);
+    }
+    bench_report("slice_remaining_circuit", mark, rounds);
+}
+
+
+static void bench_circuit(const config_t *config, const device_t *device, const char *device_file,
+                          const circuit_t *circuit, const char *circuit_file) {
+    if (circuit->num_qubits > device->num_qubits) {
+        printf("%s on %s: skipped, %zu qubits do not fit %d\n\n",
+               circuit_file, device_file, circuit->num_qubits, device->num_qubits);
+        return;
+    }
+
+    telesabre_t *ts = telesabre_init(config, device, circuit);
+
+    const gate_t **gates = malloc(sizeof(gate_t *) * (circuit->num_gates + 1));
+    check_alloc(1, gates);
+    size_t num_gates = 0;
+    for (size_t i = 0; i < circuit->num_gates; i++) {
+        if (layout_gate_is_separated(ts->layout, &circuit->gates[i])) gates[num_gates++] = &circuit->gates[i];
+    }
+
+    printf("%s on %s: %zu qubits, %zu gates, %zu separated\n",
+           circuit_file, device_file, circuit->num_qubits, circuit->num_gates, num_gates);
+
+    rng_t rng;
+    rng_seed(&rng, config->seed);
+
+    bench_dijkstra(ts, gates, num_gates);
+    bench_heap(device->num_comm_qubits + 2, &rng);
+    bench_layout(ts);
+    bench_slicing(ts);
+    printf("\n");
+
+    free(gates);
+    telesabre_free(ts);
+}
+
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <config.json> <device.json> [...] <circuit.qasm> [...]\n", argv[0]);
+        return 1;
+    }
+
+    config_t *config = config_from_json(argv[1]);
+    // The Hungarian layout does not place every circuit on every device, round robin does
+    config->initial_layout_type = INITIAL_LAYOUT_ROUND_ROBIN;
+
+    if (!alloc_count_supported())
+        printf("Allocation counts need a build with -DTS_COUNT_ALLOCATIONS\n\n");
+
+    for (int d = 2; d < argc; d++) {
+        if (!has_suffix(argv[d], ".json")) continue;
+        device_t *device = device_from_json(argv[d]);
+        for (int c = 2; c < argc; c++) {
+            if (!has_suffix(argv[c], ".qasm")) continue;
+            circuit_t *circuit = circuit_from_qasm(argv[c]);
+            bench_circuit(config, device, argv[d], circuit, argv[c]);
+            circuit_free(circuit);
+        }
+        device_free(device);
+    }
+
+    config_free(config);
+    return 0;
+}
@@ -0,0 +1,357 @@
+// Routes every circuit of circuits/qasm_25 and circuits/qasm_64 on every device of devices/
+// over fixed seeds, one child process per run, and reports time, throughput, peak memory and
+// operation counts. With a baseline from an earlier --format json run, regressions in
+// throughput or communication/swap counts above the threshold fail the run.
+//
+// gcc -O3 -pthread -I src bench/telesabre_bench.c $(ls src/*.c | grep -v main.c) -o ./telesabre-bench -lm
+// ./telesabre-bench [--config configs/default.json] [--seeds 3] [--format csv|json] [--output <file>]
+//                   [--baseline <file.json>] [--threshold 0.1] [--timeout 600] [--min_time 0.2]
+
+#include <dirent.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "circuit.h"
+#include "config.h"
+#include "device.h"
+#include "json.h"
+#include "telesabre.h"
+#include "utils.h"
+
+#define BENCH_MAX_FILES 64
+#define BENCH_NAME_SIZE 128
+
+static const char *bench_circuit_dirs[] = {"circuits/qasm_25", "circuits/qasm_64"};
+static const char *bench_device_dir = "devices";
+
+
+typedef enum {
+    BENCH_OK,
+    BENCH_FAILED,   // Routing did not complete
+    BENCH_ERROR,    // Exited with an error before the result
+    BENCH_CRASHED,
+    BENCH_TIMEOUT
+} bench_status_t;
+
+static const char *bench_status_str[] = {"ok", "failed", "error", "crashed", "timeout"};
+
+typedef struct {
+    char device[BENCH_NAME_SIZE];
+    char circuit[BENCH_NAME_SIZE];
+    unsigned seed;
+    bench_status_t status;
+    double seconds;
+    long iterations;
+    long peak_rss_kb;
+    int num_teledata;
+    int num_telegate;
+    int num_swaps;
+    int num_deadlocks;
+} bench_run_t;
+
+typedef struct {
+    char paths[BENCH_MAX_FILES][256];
+    int count;
+} bench_files_t;
+
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+
+static void bench_list_files(const char *dir, const char *ext, bench_files_t *files) {
+    DIR *d = opendir(dir);
+    if (d == NULL) error("Could not open directory %s, run from the repository root.", dir);
+    int first = files->count;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcmp(dot, ext) != 0) continue;
+        if (files->count >= BENCH_MAX_FILES) error("More than %d files to benchmark.", BENCH_MAX_FILES);
+        int length = snprintf(files->paths[files->count], sizeof(files->paths[0]), "%s/%s", dir, entry->d_name);
+        if (length >= (int)sizeof(files->paths[0])) error("Path %s/%s is too long.", dir, entry->d_name);
+        files->count++;
+    }
+    closedir(d);
+    qsort(files->paths[first], files->count - first, sizeof(files->paths[0]), compare_paths);
+}
+
+
+// Child side of a run, the result goes back through the pipe. Short runs are repeated until
+// min_seconds have passed and the fastest repetition is kept, the results are the same each time.
+static void bench_child(const char *config_file, const char *device_file, const char *circuit_file,
+                        unsigned seed, int timeout, double min_seconds, int fd) {
+    alarm(timeout);
+    config_t *config = config_from_json(config_file);
+    config->seed = seed;
+    config->save_report = false;
+    config->jobs = 1;
+    device_t *device = device_from_json(device_file);
+    circuit_t *circuit = circuit_from_qasm(circuit_file);
+
+    result_t result;
+    double seconds = INFINITY;
+    double first_start = monotonic_seconds();
+    do {
+        double start = monotonic_seconds();
+        result = telesabre_run(config, device, circuit);
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < seconds) seconds = elapsed;
+    } while (monotonic_seconds() - first_start < min_seconds);
+
+    bench_run_t run = {
+        .status = result.success ? BENCH_OK : BENCH_FAILED,
+        .seconds = seconds,
+        .iterations = result.stats.num_iterations,
+        .num_teledata = result.num_teledata,
+        .num_telegate = result.num_telegate,
+        .num_swaps = result.num_swaps,
+        .num_deadlocks = result.num_deadlocks
+    };
+    if (write(fd, &run, sizeof(run)) != sizeof(run)) _exit(1);
+    _exit(0);
+}
+
+
+static bench_run_t bench_run(const char *config_file, const char *device_file, const char *circuit_file,
+                             unsigned seed, int timeout, double min_seconds) {
+    int fds[2];
+    if (pipe(fds) != 0) error("Could not create a pipe.");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) error("Could not fork.");
+    if (pid == 0) {
+        close(fds[0]);
+        bench_child(config_file, device_file, circuit_file, seed, timeout, min_seconds, fds[1]);
+    }
+    close(fds[1]);
+
+    bench_run_t run = {0};
+    ssize_t received = read(fds[0], &run, sizeof(run));
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    if (received != sizeof(run)) {
+        run = (bench_run_t){0};
+        if (WIFEXITED(status)) run.status = BENCH_ERROR;
+        else run.status = WTERMSIG(status) == SIGALRM ? BENCH_TIMEOUT : BENCH_CRASHED;
+    }
+    run.peak_rss_kb = usage.ru_maxrss;
+    run.seed = seed;
+    filepath_basename(device_file, run.device, sizeof(run.device));
+    filepath_basename(circuit_file, run.circuit, sizeof(run.circuit));
+    return run;
+}
+
+
+static double bench_iterations_per_second(const bench_run_t *run) {
+    return run->seconds > 0 ? run->iterations / run->seconds : 0.0;
+}
+
+
+static void bench_write_csv(FILE *out, const bench_run_t *runs, int num_runs) {
+    fprintf(out, "device,circuit,seed,status,seconds,iterations,iterations_per_second,peak_rss_kb,teledata,telegate,swaps,deadlocks\n");
+    for (int i = 0; i < num_runs; i++) {
+        const bench_run_t *r = &runs[i];
+        fprintf(out, "%s,%s,%u,%s,%.6f,%ld,%.1f,%ld,%d,%d,%d,%d\n",
+                r->device, r->circuit, r->seed, bench_status_str[r->status], r->seconds, r->iterations,
+                bench_iterations_per_second(r), r->peak_rss_kb, r->num_teledata, r->num_telegate, r->num_swaps, r->num_deadlocks);
+    }
+}
+
+
+static void bench_write_json(FILE *out, const bench_run_t *runs, int num_runs) {
+    cJSON *json = cJSON_CreateArray();
+    for (int i = 0; i < num_runs; i++) {
+        const bench_run_t *r = &runs[i];
+        cJSON *run = cJSON_CreateObject();
+        cJSON_AddStringToObject(run, "device", r->device);
+        cJSON_AddStringToObject(run, "circuit", r->circuit);
+        cJSON_AddNumberToObject(run, "seed", r->seed);
+        cJSON_AddStringToObject(run, "status", bench_status_str[r->status]);
+        cJSON_AddNumberToObject(run, "seconds", r->seconds);
+        cJSON_AddNumberToObject(run, "iterations", r->iterations);
+        cJSON_AddNumberToObject(run, "iterations_per_second", bench_iterations_per_second(r));
+        cJSON_AddNumberToObject(run, "peak_rss_kb", r->peak_rss_kb);
+        cJSON_AddNumberToObject(run, "teledata", r->num_teledata);
+        cJSON_AddNumberToObject(run, "telegate", r->num_telegate);
+        cJSON_AddNumberToObject(run, "swaps", r->num_swaps);
+        cJSON_AddNumberToObject(run, "deadlocks", r->num_deadlocks);
+        cJSON_AddItemToArray(json, run);
+    }
+    char *str = cJSON_Print(json);
+    fprintf(out, "%s\n", str);
+    free(str);
+    cJSON_Delete(json);
+}
+
+
+// Totals of the runs of one device and circuit, over seeds that succeeded in both sets
+typedef struct {
+    double seconds;
+    long iterations;
+    long comm_ops;
+    long swaps;
+    int num_runs;
+} bench_totals_t;
+
+
+static const cJSON *bench_find_baseline_run(const cJSON *baseline, const bench_run_t *run) {
+    const cJSON *entry;
+    cJSON_ArrayForEach(entry, baseline) {
+        const cJSON *device = cJSON_GetObjectItemCaseSensitive(entry, "device");
+        const cJSON *circuit = cJSON_GetObjectItemCaseSensitive(entry, "circuit");
+        const cJSON *seed = cJSON_GetObjectItemCaseSensitive(entry, "seed");
+        if (device && circuit && seed && strcmp(device->valuestring, run->device) == 0 &&
+            strcmp(circuit->valuestring, run->circuit) == 0 && (unsigned)seed->valuedouble == run->seed)
+            return entry;
+    }
+    return NULL;
+}
+
+
+static double bench_json_number(const cJSON *entry, const char *key) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(entry, key);
+    return item ? item->valuedouble : 0.0;
+}
+
+
+// Returns the number of regressions, each reported on stderr. Throughput and quality are
+// compared on totals per device and circuit, single short runs are too noisy to time.
+static int bench_compare(const bench_run_t *runs, int num_runs, const char *baseline_file, double threshold) {
+    const char *baseline_str = read_file(baseline_file);
+    if (baseline_str == NULL) error("Could not read baseline %s.", baseline_file);
+    cJSON *baseline = cJSON_Parse(baseline_str);
+    free((void *)baseline_str);
+    if (!cJSON_IsArray(baseline)) error("Baseline %s is not a --format json output.", baseline_file);
+
+    int num_regressions = 0;
+    for (int i = 0; i < num_runs; ) {
+        bench_totals_t now = {0}, base = {0};
+        int j = i;
+        for (; j < num_runs && strcmp(runs[j].device, runs[i].device) == 0 && strcmp(runs[j].circuit, runs[i].circuit) == 0; j++) {
+            const bench_run_t *run = &runs[j];
+            const cJSON *entry = bench_find_baseline_run(baseline, run);
+            if (entry == NULL) continue;
+            const cJSON *status = cJSON_GetObjectItemCaseSensitive(entry, "status");
+            bool base_ok = status && strcmp(status->valuestring, "ok") == 0;
+            if (base_ok && run->status != BENCH_OK) {
+                fprintf(stderr, RED "Regression" CRESET " %s %s seed %u: %s, ok in the baseline\n",
+                        run->device, run->circuit, run->seed, bench_status_str[run->status]);
+                num_regressions++;
+            }
+            if (!base_ok || run->status != BENCH_OK) continue;
+
+            now.seconds += run->seconds;
+            now.iterations += run->iterations;
+            now.comm_ops += run->num_teledata + run->num_telegate;
+            now.swaps += run->num_swaps;
+            base.seconds += bench_json_number(entry, "seconds");
+            base.iterations += (long)bench_json_number(entry, "iterations");
+            base.comm_ops += (long)(bench_json_number(entry, "teledata") + bench_json_number(entry, "telegate"));
+            base.swaps += (long)bench_json_number(entry, "swaps");
+            now.num_runs++;
+        }
+
+        if (now.num_runs > 0 && now.seconds > 0 && base.seconds > 0) {
+            double now_throughput = now.iterations / now.seconds;
+            double base_throughput = base.iterations / base.seconds;
+            if (now_throughput < base_throughput * (1.0 - threshold)) {
+                fprintf(stderr, RED "Regression" CRESET " %s %s: %.0f iterations/s, %.0f in the baseline\n",
+                        runs[i].device, runs[i].circuit, now_throughput, base_throughput);
+                num_regressions++;
+            }
+            if (now.comm_ops > base.comm_ops * (1.0 + threshold)) {
+                fprintf(stderr, RED "Regression" CRESET " %s %s: %ld communication ops, %ld in the baseline\n",
+                        runs[i].device, runs[i].circuit, now.comm_ops, base.comm_ops);
+                num_regressions++;
+            }
+            if (now.swaps > base.swaps * (1.0 + threshold)) {
+                fprintf(stderr, RED "Regression" CRESET " %s %s: %ld swaps, %ld in the baseline\n",
+                        runs[i].device, runs[i].circuit, now.swaps, base.swaps);
+                num_regressions++;
+            }
+        }
+        i = j;
+    }
+
+    cJSON_Delete(baseline);
+    return num_regressions;
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *config_file = "configs/default.json";
+    const char *output_file = NULL;
+    const char *baseline_file = NULL;
+    bool json_format = false;
+    int num_seeds = 3;
+    double threshold = 0.1;
+    int timeout = 600;
+    double min_seconds = 0.2;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) error("Missing value for %s.", argv[i]);
+        const char *key = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(key, "--config") == 0) config_file = value;
+        else if (strcmp(key, "--seeds") == 0) num_seeds = atoi(value);
+        else if (strcmp(key, "--format") == 0) json_format = strcmp(value, "json") == 0;
+        else if (strcmp(key, "--output") == 0) output_file = value;
+        else if (strcmp(key, "--baseline") == 0) baseline_file = value;
+        else if (strcmp(key, "--threshold") == 0) threshold = atof(value);
+        else if (strcmp(key, "--timeout") == 0) timeout = atoi(value);
+        else if (strcmp(key, "--min_time") == 0) min_seconds = atof(value);
+        else error("Unknown option %s.", key);
+    }
+
+    config_t *config = config_from_json(config_file);
+    if (config == NULL) error("Could not load config %s.", config_file);
+    unsigned first_seed = config->seed;
+    config_free(config);
+
+    bench_files_t circuits = {0}, devices = {0};
+    for (size_t i = 0; i < sizeof(bench_circuit_dirs) / sizeof(bench_circuit_dirs[0]); i++)
+        bench_list_files(bench_circuit_dirs[i], ".qasm", &circuits);
+    bench_list_files(bench_device_dir, ".json", &devices);
+
+    int num_runs = 0;
+    bench_run_t *runs = malloc(sizeof(bench_run_t) * devices.count * circuits.count * num_seeds);
+    check_alloc(1, runs);
+    for (int d = 0; d < devices.count; d++) {
+        for (int c = 0; c < circuits.count; c++) {
+            for (int s = 0; s < num_seeds; s++) {
+                bench_run_t *run = &runs[num_runs++];
+                *run = bench_run(config_file, devices.paths[d], circuits.paths[c], first_seed + s, timeout, min_seconds);
+                fprintf(stderr, "%s %s seed %u: %s, %.3fs, %.0f iterations/s\n", run->device, run->circuit,
+                        run->seed, bench_status_str[run->status], run->seconds, bench_iterations_per_second(run));
+            }
+        }
+    }
+
+    FILE *out = output_file ? fopen(output_file, "w") : stdout;
+    if (out == NULL) error("Could not open %s.", output_file);
+    if (json_format) bench_write_json(out, runs, num_runs);
+    else bench_write_csv(out, runs, num_runs);
+    if (out != stdout) fclose(out);
+
+    int num_regressions = 0;
+    if (baseline_file != NULL) {
+        num_regressions = bench_compare(runs, num_runs, baseline_file, threshold);
+        fprintf(stderr, "%d regression(s) against %s with threshold %.0f%%\n", num_regressions, baseline_file, threshold * 100);
+    }
+
+    free(runs);
+    return num_regressions > 0 ? 1 : 0;
+}
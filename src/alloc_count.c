@@ -0,0 +1,64 @@
+#include "alloc_count.h"
+
+#include <stdatomic.h>
+
+
+static atomic_size_t alloc_count = 0;
+static atomic_bool alloc_count_paused = false;
+
+
+#ifdef TS_COUNT_ALLOCATIONS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+
+static void alloc_count_increment(void) {
+    if (!atomic_load_explicit(&alloc_count_paused, memory_order_relaxed))
+        atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+}
+
+
+void *malloc(size_t size) {
+    alloc_count_increment();
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t num, size_t size) {
+    alloc_count_increment();
+    return __libc_calloc(num, size);
+}
+
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count_increment();
+    return __libc_realloc(ptr, size);
+}
+
+#endif
+
+
+bool alloc_count_supported(void) {
+#ifdef TS_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+size_t alloc_count_get(void) {
+    return atomic_load(&alloc_count);
+}
+
+
+void alloc_count_pause(void) {
+    atomic_store(&alloc_count_paused, true);
+}
+
+
+void alloc_count_resume(void) {
+    atomic_store(&alloc_count_paused, false);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Process-wide heap allocation counter, used to check that routing steps do not 
+// allocate. Counting needs a glibc build with -DTS_COUNT_ALLOCATIONS, which 
+// interposes malloc, calloc and realloc. Other builds report no support.
+
+bool alloc_count_supported(void);
+
+size_t alloc_count_get(void);
+
+// Allocations made while paused are not counted
+void alloc_count_pause(void);
+void alloc_count_resume(void);
@@ -7,12 +7,13 @@
 #include <string.h>
 
 #include "json.h"
+#include "log.h"
 #include "utils.h"
 
 
 circuit_t* circuit_from_qasm(const char* filename) 
 {
-    printf("Loading circuit from QASM file: %s\n", filename);
+    log_printf(LOG_SUMMARY, "Loading circuit from QASM file: %s\n", filename);
 
     regex_t regex;
     char regex_str[] = "([[:alnum:]_]*)(\\([[:alnum:]_\\./-]*\\))* ([[:alnum:]_]*)\\[([0-9]*)\\](,([[:alnum:]_]+)\\[([0-9]*)\\])*;";
@@ -183,7 +184,7 @@ circuit_t *circuit_from_json(const char *filename) {
         return NULL;
     }
 
-    printf("Loading circuit from JSON file: %s\n", filename);    
+    log_printf(LOG_SUMMARY, "Loading circuit from JSON file: %s\n", filename);    
     circuit_t *circuit = malloc(sizeof(circuit_t));
     *circuit = (circuit_t){0};
     circuit->json = NULL;
@@ -346,7 +347,7 @@ void circuit_print(circuit_t* circuit)
 }
 
 
-sliced_circuit_view_t* circuit_get_sliced_view(circuit_t* circuit, bool two_qubit_only) {
+sliced_circuit_view_t* circuit_get_sliced_view(const circuit_t* circuit, bool two_qubit_only) {
     if (!circuit) return NULL;
 
     sliced_circuit_view_t* view = malloc(sizeof(sliced_circuit_view_t));
@@ -373,13 +374,13 @@ sliced_circuit_view_t* circuit_get_sliced_view(circuit_t* circuit, bool two_qubi
             memset(qubit_used_in_slice, 0, sizeof(bool) * circuit->num_qubits);
 
             for (size_t gg = 0; gg < view->slice_sizes[t]; gg++) {
-                gate_t* ggate = &circuit->gates[view->slices[t][gg]];
+                const gate_t* ggate = &circuit->gates[view->slices[t][gg]];
                 for (size_t j = 0; j < ggate->num_target_qubits; j++)
                     qubit_used_in_slice[ggate->target_qubits[j]] = true;
             }
 
             size_t tt = t;
-            gate_t* gate = &circuit->gates[g];
+            const gate_t* gate = &circuit->gates[g];
             for (size_t j = 0; j < gate->num_target_qubits && !allocated; j++) {
                 if (qubit_used_in_slice[gate->target_qubits[j]]) {
                     tt = t + 1;
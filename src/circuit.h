@@ -39,7 +39,7 @@ typedef struct circuit
 
 typedef struct sliced_circuit_view
 {
-    circuit_t *circuit;
+    const circuit_t *circuit;
     size_t num_slices;
     size_t *slice_sizes;
     size_t **slices;        // gate_ids
@@ -66,7 +66,7 @@ void circuit_print(circuit_t *circuit);
 void circuit_free(circuit_t *circuit);
 
 
-sliced_circuit_view_t* circuit_get_sliced_view(circuit_t *circuit, bool two_qubit_only);
+sliced_circuit_view_t* circuit_get_sliced_view(const circuit_t *circuit, bool two_qubit_only);
 
 void sliced_circuit_view_print(sliced_circuit_view_t *view);
 
@@ -45,12 +45,25 @@ config_t* config_new() {
 
     config->save_report = true;
     strcpy(config->report_filename, "report.json");
+    config->trace_filename[0] = '\0';
 
     config->enable_passing_core_emptying_teleport_possibility = false;
+    config->enable_energy_pruning = true;
+    config->enable_energy_cache = true;
+    config->enable_fixed_nearest_free_ties = false;
+    config->top_k_candidates = 0;
+    config->audit_top_k_candidates = false;
 
     config->max_attempts = 10;
     config->required_successes = 1;
 
+    config->num_threads = 1;
+    config->jobs = 1;
+
+    config->check_allocations = false;
+
+    config->log_level = LOG_QUIET;
+
     config->json = NULL;
     return config;
 }
@@ -72,7 +85,6 @@ config_t *config_from_json(const char* filename) {
         return NULL;
     }
 
-    printf("Loading config from JSON file: %s\n", filename);
     config_t *cfg = config_new();
 
     #define X(name) \
@@ -114,6 +126,10 @@ config_t *config_from_json(const char* filename) {
         config_set_initial_layout_type(cfg, initial_layout_type_str);
     }
 
+    const cJSON *json_log_level = cJSON_GetObjectItemCaseSensitive(config_json, "log_level");
+    if (json_log_level && cJSON_IsString(json_log_level))
+        config_set_log_level(cfg, json_log_level->valuestring);
+
     cfg->json = cJSON_Duplicate(config_json, 1);
     cJSON_Delete(config_json_file);
     return cfg;
@@ -144,6 +160,11 @@ void config_set_energy_type(config_t *config, const char *value) {
 }
 
 
+void config_set_log_level(config_t *config, const char *value) {
+    config->log_level = log_level_from_str(value);
+}
+
+
 void config_set_parameter(config_t *config, const char *key, const char *value) {
     #define X(name) \
         if (strcmp(key, #name) == 0) { \
@@ -187,6 +208,11 @@ void config_set_parameter(config_t *config, const char *key, const char *value)
         config_set_energy_type(config, value);
         return;
     }
+
+    if (strcmp(key, "log_level") == 0) {
+        config_set_log_level(config, value);
+        return;
+    }
 }
 
 
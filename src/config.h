@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "json.h"
+#include "log.h"
 
 enum energy_type { 
     ENERGY_TYPE_EXTENDED_SET, 
@@ -51,12 +52,25 @@ typedef struct config {
 
     bool save_report;
     char report_filename[256];
+    char trace_filename[256];  // Chrome trace of the routing phases, off if empty
 
     bool enable_passing_core_emptying_teleport_possibility;
+    bool enable_energy_pruning;  // Stop candidate evaluations that cannot reach the best energy
+    bool enable_energy_cache;    // Reuse separated gate path costs across evaluations and iterations
+    bool enable_fixed_nearest_free_ties;  // Break nearest free qubit ties by physical id instead of heap history
+    int top_k_candidates;        // Full lookahead only for the best k candidates on front energy, 0 for all
+    bool audit_top_k_candidates; // Also evaluate the cut candidates to count changed choices
 
     int max_attempts;
     int required_successes;
 
+    int num_threads;  // Candidate evaluation threads
+    int jobs;         // Attempts run in parallel
+
+    bool check_allocations;  // Fail if an iteration allocates (needs -DTS_COUNT_ALLOCATIONS)
+
+    log_level_t log_level;  // quiet, summary, debug or trace
+
     cJSON *json;
 } config_t;
 
@@ -74,7 +88,10 @@ typedef struct config {
     X(init_layout_hun_min_free_qubit) \
     X(max_iterations) \
     X(max_attempts) \
-    X(required_successes)
+    X(required_successes) \
+    X(num_threads) \
+    X(jobs) \
+    X(top_k_candidates)
 
 #define TS_CONFIG_FLOAT_ENTRIES \
     X(gate_usage_penalty) \
@@ -86,11 +103,17 @@ typedef struct config {
 #define TS_CONFIG_BOOL_ENTRIES \
     X(optimize_initial) \
     X(save_report) \
-    X(enable_passing_core_emptying_teleport_possibility)
+    X(enable_passing_core_emptying_teleport_possibility) \
+    X(enable_energy_pruning) \
+    X(enable_energy_cache) \
+    X(enable_fixed_nearest_free_ties) \
+    X(audit_top_k_candidates) \
+    X(check_allocations)
 
 #define TS_CONFIG_STRING_ENTRIES \
     X(name) \
-    X(report_filename)
+    X(report_filename) \
+    X(trace_filename)
 
 
 config_t *config_new();
@@ -99,6 +122,7 @@ config_t *config_from_json(const char *filename);
 
 void config_set_initial_layout_type(config_t *config, const char *value);
 void config_set_energy_type(config_t *config, const char *value);
+void config_set_log_level(config_t *config, const char *value);
 void config_set_parameter(config_t *config, const char *key, const char *value);
 
 void config_free(config_t *config);
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "device.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "json.h"
+#include "log.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 
@@ -58,7 +63,7 @@ device_t* device_new_grid(int core_x, int core_y, int qubit_x, int qubit_y) {
         }
     }
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     device_calculate_distance_matrix(dev);
 
@@ -83,7 +88,7 @@ device_t *device_from_json(const char *filename) {
         return NULL;
     }
 
-    printf("Loading device from JSON file: %s\n", filename);
+    log_printf(LOG_SUMMARY, "Loading device from JSON file: %s\n", filename);
 
     device_t *dev = malloc(sizeof(device_t));
     *dev = (device_t){0};
@@ -128,7 +133,7 @@ device_t *device_from_json(const char *filename) {
         };
     }
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     device_calculate_distance_matrix(dev);
     
@@ -138,139 +143,490 @@ device_t *device_from_json(const char *filename) {
 }
 
 
-void device_update_qubit_to_edges(device_t* dev) {
-    if (dev->qubit_to_edges != NULL) {
-        for (pqubit_t i = 0; i < dev->num_qubits; i++)
-            if (dev->qubit_to_edges[i] != NULL) free(dev->qubit_to_edges[i]);
-        free(dev->qubit_to_edges);
-    }
+void device_build_adjacency(device_t* dev) {
+    if (dev->qubit_edge_offsets != NULL) free(dev->qubit_edge_offsets);
+    if (dev->qubit_neighbors != NULL) free(dev->qubit_neighbors);
 
-    if (dev->qubit_num_edges != NULL) free(dev->qubit_num_edges);
-    dev->qubit_num_edges = calloc(dev->num_qubits, sizeof(int));
+    dev->qubit_edge_offsets = calloc(dev->num_qubits + 1, sizeof(int));
+    dev->qubit_neighbors = malloc(sizeof(pqubit_t) * (2 * dev->num_edges + 1));
+    int *fill = malloc(sizeof(int) * (dev->num_qubits + 1));
+    check_alloc(3, dev->qubit_edge_offsets, dev->qubit_neighbors, fill);
 
-    dev->qubit_to_edges = malloc(sizeof(device_edge_t*) * dev->num_qubits);
-    for (pqubit_t i = 0; i < dev->num_qubits; i++) {
-        for (int j = 0; j < dev->num_edges; j++)
-            if (dev->edges[j].p1 == i || dev->edges[j].p2 == i) dev->qubit_num_edges[i]++;
-
-        dev->qubit_to_edges[i] = malloc(sizeof(device_edge_t) * dev->qubit_num_edges[i]);
-        int k = 0;
-        for (int j = 0; j < dev->num_edges; j++) {
-            if (dev->edges[j].p1 == i || dev->edges[j].p2 == i) {
-                dev->qubit_to_edges[i][k] = dev->edges[j];
-                k++;
-            }
-        }
+    for (int e = 0; e < dev->num_edges; e++) {
+        dev->qubit_edge_offsets[dev->edges[e].p1 + 1]++;
+        if (dev->edges[e].p2 != dev->edges[e].p1) dev->qubit_edge_offsets[dev->edges[e].p2 + 1]++;
+    }
+    for (pqubit_t p = 0; p < dev->num_qubits; p++)
+        dev->qubit_edge_offsets[p + 1] += dev->qubit_edge_offsets[p];
+
+    memcpy(fill, dev->qubit_edge_offsets, sizeof(int) * (dev->num_qubits + 1));
+    for (int e = 0; e < dev->num_edges; e++) {
+        pqubit_t p1 = dev->edges[e].p1, p2 = dev->edges[e].p2;
+        dev->qubit_neighbors[fill[p1]++] = p2;
+        if (p2 != p1) dev->qubit_neighbors[fill[p2]++] = p1;
     }
+    free(fill);
+}
+
+
+int device_get_degree(const device_t* device, pqubit_t p) {
+    return device->qubit_edge_offsets[p + 1] - device->qubit_edge_offsets[p];
 }
 
 
 void device_build_teleport_edges(device_t* dev) {
     if (dev->tp_edges != NULL) free(dev->tp_edges);
-    dev->num_tp_edges = 0;
-    dev->tp_edges = NULL;
-
-    bool* qubit_is_comm = calloc(dev->num_qubits, sizeof(bool));
+    if (dev->tp_edge_offsets != NULL) free(dev->tp_edge_offsets);
+    if (dev->qubit_is_comm != NULL) free(dev->qubit_is_comm);
+    if (dev->comm_qubits != NULL) free(dev->comm_qubits);
+    if (dev->comm_qubit_node_id != NULL) free(dev->comm_qubit_node_id);
+    if (dev->core_comm_qubits != NULL) free(dev->core_comm_qubits);
+    if (dev->core_comm_qubits_storage != NULL) free(dev->core_comm_qubits_storage);
+    if (dev->core_num_comm_qubits != NULL) free(dev->core_num_comm_qubits);
 
+    // Mark the qubits of inter-core edges as communication qubits, a teleport goes 
+    // from any neighbor of one end, through that end, to the other end
+    dev->qubit_is_comm = calloc(dev->num_qubits, sizeof(bool));
+    dev->tp_edge_offsets = calloc(dev->num_qubits + 1, sizeof(int));
+    check_alloc(2, dev->qubit_is_comm, dev->tp_edge_offsets);
+    dev->num_tp_edges = 0;
     for (int e = 0; e < dev->num_intercore_edges; e++) {
         pqubit_t p1 = dev->inter_core_edges[e].p1;
         pqubit_t p2 = dev->inter_core_edges[e].p2;
+        dev->qubit_is_comm[p1] = true;
+        dev->qubit_is_comm[p2] = true;
+        dev->tp_edge_offsets[p1 + 1] += device_get_degree(dev, p1);
+        dev->tp_edge_offsets[p2 + 1] += device_get_degree(dev, p2);
+        dev->num_tp_edges += device_get_degree(dev, p1) + device_get_degree(dev, p2);
+    }
+    for (pqubit_t p = 0; p < dev->num_qubits; p++)
+        dev->tp_edge_offsets[p + 1] += dev->tp_edge_offsets[p];
 
-        // Mark the qubits as communication qubits
-        qubit_is_comm[p1] = true;
-        qubit_is_comm[p2] = true;
+    dev->tp_edges = malloc(sizeof(device_tp_edge_t) * (dev->num_tp_edges + 1));
+    int *fill = malloc(sizeof(int) * (dev->num_qubits + 1));
+    check_alloc(2, dev->tp_edges, fill);
+    memcpy(fill, dev->tp_edge_offsets, sizeof(int) * (dev->num_qubits + 1));
+    for (int e = 0; e < dev->num_intercore_edges; e++) {
+        pqubit_t p1 = dev->inter_core_edges[e].p1;
+        pqubit_t p2 = dev->inter_core_edges[e].p2;
+        for (int k = dev->qubit_edge_offsets[p1]; k < dev->qubit_edge_offsets[p1 + 1]; k++)
+            dev->tp_edges[fill[p1]++] = (device_tp_edge_t){.p_source = dev->qubit_neighbors[k], .p_mediator = p1, .p_target = p2};
+        for (int k = dev->qubit_edge_offsets[p2]; k < dev->qubit_edge_offsets[p2 + 1]; k++)
+            dev->tp_edges[fill[p2]++] = (device_tp_edge_t){.p_source = dev->qubit_neighbors[k], .p_mediator = p2, .p_target = p1};
+    }
+    free(fill);
 
-        // Forward direction
-        for (int e_ = 0; e_ < dev->qubit_num_edges[p1]; e_++) {
-            pqubit_t p1_neighbor = dev->qubit_to_edges[p1][e_].p1;
-            if (p1_neighbor == p1) {
-                p1_neighbor = dev->qubit_to_edges[p1][e_].p2;
-            }
-            dev->tp_edges = realloc(dev->tp_edges, sizeof(device_tp_edge_t) * (dev->num_tp_edges + 1));
-            dev->tp_edges[dev->num_tp_edges++] = (device_tp_edge_t){.p_source = p1_neighbor, .p_mediator = p1, .p_target = p2};
+    // Comm qubit lists, in qubit order overall and within each core
+    dev->num_comm_qubits = 0;
+    dev->core_num_comm_qubits = calloc(dev->num_cores, sizeof(int));
+    dev->comm_qubit_node_id = malloc(sizeof(int) * dev->num_qubits);
+    check_alloc(2, dev->core_num_comm_qubits, dev->comm_qubit_node_id);
+    for (pqubit_t p = 0; p < dev->num_qubits; p++) {
+        dev->comm_qubit_node_id[p] = -1;
+        if (dev->qubit_is_comm[p]) {
+            dev->comm_qubit_node_id[p] = dev->num_comm_qubits++;
+            dev->core_num_comm_qubits[dev->phys_to_core[p]]++;
         }
+    }
 
-        // Reverse direction
-        for (int e_ = 0; e_ < dev->qubit_num_edges[p2]; e_++) {
-            pqubit_t p2_neighbor = dev->qubit_to_edges[p2][e_].p1;
-            if (p2_neighbor == p2) {
-                p2_neighbor = dev->qubit_to_edges[p2][e_].p2;
-            }
-            dev->tp_edges = realloc(dev->tp_edges, sizeof(device_tp_edge_t) * (dev->num_tp_edges + 1));
-            dev->tp_edges[dev->num_tp_edges++] = (device_tp_edge_t){.p_source = p2_neighbor, .p_mediator = p2, .p_target = p1};
+    dev->comm_qubits = malloc(sizeof(pqubit_t) * (dev->num_comm_qubits + 1));
+    dev->core_comm_qubits = malloc(sizeof(pqubit_t*) * dev->num_cores);
+    dev->core_comm_qubits_storage = malloc(sizeof(pqubit_t) * (dev->num_comm_qubits + 1));
+    check_alloc(3, dev->comm_qubits, dev->core_comm_qubits, dev->core_comm_qubits_storage);
+    int offset = 0;
+    for (core_t c = 0; c < dev->num_cores; c++) {
+        dev->core_comm_qubits[c] = &dev->core_comm_qubits_storage[offset];
+        offset += dev->core_num_comm_qubits[c];
+        dev->core_num_comm_qubits[c] = 0;
+    }
+    for (pqubit_t p = 0; p < dev->num_qubits; p++) {
+        if (!dev->qubit_is_comm[p]) continue;
+        dev->comm_qubits[dev->comm_qubit_node_id[p]] = p;
+        core_t c = dev->phys_to_core[p];
+        dev->core_comm_qubits[c][dev->core_num_comm_qubits[c]++] = p;
+    }
+}
+
+
+// Intra-core adjacency of every core in positions of core_qubits, neighbor lists sorted
+typedef struct {
+    int *offsets;          // core_capacity + 1 entries per core
+    int *neighbors;        // Neighbors of a core start at core_edge_start[core]
+    int *core_edge_start;
+} core_adjacency_t;
+
+// Individualization-refinement search for an isomorphism between two cores, vertices 
+// 0..n-1 are the qubits of the first core and n..2n-1 the qubits of the second one
+typedef struct {
+    int n;
+    int *offsets;       // Disjoint union of both cores, CSR
+    int *neighbors;
+    int *signatures;    // Sorted neighbor colors of each vertex, same layout as neighbors
+    int *order;
+    int *counts;
+    const int *colors;  // Colors being refined, read by the sort comparator
+    int budget;         // Search nodes left before giving up
+} core_iso_t;
+
+static _Thread_local const core_iso_t *core_iso_sort_ctx;
+
+
+static int compare_ints(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+
+static int core_iso_compare_vertices(const void *a, const void *b) {
+    const core_iso_t *iso = core_iso_sort_ctx;
+    int u = *(const int *)a, v = *(const int *)b;
+    if (iso->colors[u] != iso->colors[v]) return iso->colors[u] < iso->colors[v] ? -1 : 1;
+    int du = iso->offsets[u + 1] - iso->offsets[u], dv = iso->offsets[v + 1] - iso->offsets[v];
+    if (du != dv) return du < dv ? -1 : 1;
+    for (int k = 0; k < du; k++) {
+        int cu = iso->signatures[iso->offsets[u] + k], cv = iso->signatures[iso->offsets[v] + k];
+        if (cu != cv) return cu < cv ? -1 : 1;
+    }
+    return (u > v) - (u < v);
+}
+
+
+static bool core_iso_same_signature(const core_iso_t *iso, const int *colors, int u, int v) {
+    int du = iso->offsets[u + 1] - iso->offsets[u];
+    return colors[u] == colors[v] && du == iso->offsets[v + 1] - iso->offsets[v] &&
+           memcmp(&iso->signatures[iso->offsets[u]], &iso->signatures[iso->offsets[v]], sizeof(int) * du) == 0;
+}
+
+
+// Refines colors until stable, false as soon as both cores have different color histograms
+static bool core_iso_refine(core_iso_t *iso, int *colors, int *num_colors) {
+    const int n2 = 2 * iso->n;
+    for (;;) {
+        for (int v = 0; v < n2; v++) {
+            for (int k = iso->offsets[v]; k < iso->offsets[v + 1]; k++)
+                iso->signatures[k] = colors[iso->neighbors[k]];
+            qsort(&iso->signatures[iso->offsets[v]], iso->offsets[v + 1] - iso->offsets[v], sizeof(int), compare_ints);
+            iso->order[v] = v;
+        }
+        iso->colors = colors;
+        core_iso_sort_ctx = iso;
+        qsort(iso->order, n2, sizeof(int), core_iso_compare_vertices);
+
+        int new_num_colors = 0;
+        for (int k = 0; k < n2; k++) {
+            if (k == 0 || !core_iso_same_signature(iso, colors, iso->order[k - 1], iso->order[k])) new_num_colors++;
+            iso->counts[k] = new_num_colors - 1;
         }
+        for (int k = 0; k < n2; k++) colors[iso->order[k]] = iso->counts[k];
+
+        memset(iso->counts, 0, sizeof(int) * n2);
+        for (int v = 0; v < iso->n; v++) iso->counts[colors[v]]++;
+        for (int v = iso->n; v < n2; v++) iso->counts[colors[v]]--;
+        for (int c = 0; c < new_num_colors; c++)
+            if (iso->counts[c] != 0) return false;
+
+        bool stable = new_num_colors == *num_colors;
+        *num_colors = new_num_colors;
+        if (stable) return true;
     }
+}
 
-    // Initialize comm qubit list
 
-    if (dev->comm_qubits != NULL) free(dev->comm_qubits);
-    dev->num_comm_qubits = 0;
-    dev->comm_qubits = NULL;
-    dev->qubit_is_comm = qubit_is_comm;
+static bool core_iso_has_edge(const core_iso_t *iso, int u, int v) {
+    int lo = iso->offsets[u], hi = iso->offsets[u + 1];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (iso->neighbors[mid] == v) return true;
+        if (iso->neighbors[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
 
-    if (dev->comm_qubit_node_id != NULL)
-        free(dev->comm_qubit_node_id);
-    dev->comm_qubit_node_id = malloc(sizeof(int) * dev->num_qubits);
-    for (pqubit_t i = 0; i < dev->num_qubits; i++)
-        dev->comm_qubit_node_id[i] = -1;
-
-    if (dev->core_comm_qubits != NULL) {
-        for (core_t i = 0; i < dev->num_cores; i++) {
-            if (dev->core_comm_qubits[i] != NULL) free(dev->core_comm_qubits[i]);
-            dev->core_comm_qubits[i] = NULL;
-            dev->core_num_comm_qubits[i] = 0;
+
+static bool core_iso_search(core_iso_t *iso, int *colors, int num_colors, int *mapping) {
+    if (iso->budget-- <= 0) return false;
+    if (!core_iso_refine(iso, colors, &num_colors)) return false;
+
+    const int n = iso->n;
+    if (num_colors == n) {
+        // Discrete coloring, the mapping is forced and has to preserve every edge
+        for (int v = n; v < 2 * n; v++) iso->order[colors[v]] = v - n;
+        for (int u = 0; u < n; u++) mapping[u] = iso->order[colors[u]];
+        for (int u = 0; u < n; u++)
+            for (int k = iso->offsets[u]; k < iso->offsets[u + 1]; k++)
+                if (!core_iso_has_edge(iso, mapping[u] + n, mapping[iso->neighbors[k]] + n)) return false;
+        return true;
+    }
+
+    // Individualize the first vertex of a non-singleton color class against each candidate
+    memset(iso->counts, 0, sizeof(int) * num_colors);
+    for (int v = 0; v < n; v++) iso->counts[colors[v]]++;
+    int x = 0;
+    while (iso->counts[colors[x]] == 1) x++;
+
+    int *next = malloc(sizeof(int) * 2 * n);
+    check_alloc(1, next);
+    bool found = false;
+    for (int y = n; y < 2 * n && !found; y++) {
+        if (colors[y] != colors[x]) continue;
+        memcpy(next, colors, sizeof(int) * 2 * n);
+        next[x] = next[y] = num_colors;
+        found = core_iso_search(iso, next, num_colors + 1, mapping);
+    }
+    free(next);
+    return found;
+}
+
+
+// Finds mapping[i] = position in core b of the qubit matching position i in core a,
+// false if the cores are not isomorphic or no isomorphism was found within the search budget
+static bool device_find_core_isomorphism(const device_t *dev, const core_adjacency_t *adj, core_t a, core_t b, int *mapping) {
+    const int n = dev->core_capacity;
+    int num_neighbors = adj->core_edge_start[a + 1] - adj->core_edge_start[a];
+    if (num_neighbors != adj->core_edge_start[b + 1] - adj->core_edge_start[b]) return false;
+
+    core_iso_t iso = {.n = n, .budget = TS_DEVICE_ISO_BUDGET};
+    iso.offsets = malloc(sizeof(int) * (2 * n + 1));
+    iso.neighbors = malloc(sizeof(int) * (2 * num_neighbors + 1));
+    iso.signatures = malloc(sizeof(int) * (2 * num_neighbors + 1));
+    iso.order = malloc(sizeof(int) * 2 * n);
+    iso.counts = malloc(sizeof(int) * 2 * n);
+    int *colors = calloc(2 * n, sizeof(int));
+    check_alloc(6, iso.offsets, iso.neighbors, iso.signatures, iso.order, iso.counts, colors);
+
+    iso.offsets[0] = 0;
+    for (int side = 0; side < 2; side++) {
+        core_t c = side == 0 ? a : b;
+        const int *offsets = &adj->offsets[c * (n + 1)];
+        const int *neighbors = &adj->neighbors[adj->core_edge_start[c]];
+        for (int i = 0; i < n; i++) {
+            int v = side * n + i;
+            iso.offsets[v + 1] = iso.offsets[v] + offsets[i + 1] - offsets[i];
+            for (int k = offsets[i]; k < offsets[i + 1]; k++)
+                iso.neighbors[iso.offsets[v] + k - offsets[i]] = side * n + neighbors[k];
         }
-        free(dev->core_comm_qubits);
-        free(dev->core_num_comm_qubits);
     }
-    dev->core_comm_qubits = calloc(dev->num_cores, sizeof(pqubit_t*));
-    dev->core_num_comm_qubits = calloc(dev->num_cores, sizeof(int));
 
-    for (pqubit_t i = 0; i < dev->num_qubits; i++) {
-        if (qubit_is_comm[i]) {
-            dev->comm_qubits = realloc(dev->comm_qubits, sizeof(pqubit_t) * (dev->num_comm_qubits + 1));
-            dev->comm_qubit_node_id[i] = dev->num_comm_qubits;
-            dev->comm_qubits[dev->num_comm_qubits++] = i;
-
-            core_t comm_qubit_core = dev->phys_to_core[i];
-            dev->core_comm_qubits[comm_qubit_core] = realloc(dev->core_comm_qubits[comm_qubit_core], sizeof(pqubit_t) * (dev->core_num_comm_qubits[comm_qubit_core] + 1));
-            dev->core_comm_qubits[comm_qubit_core][dev->core_num_comm_qubits[comm_qubit_core]] = i;
-            dev->core_num_comm_qubits[comm_qubit_core] += 1;
+    bool found = core_iso_search(&iso, colors, 1, mapping);
+
+    free(iso.offsets);
+    free(iso.neighbors);
+    free(iso.signatures);
+    free(iso.order);
+    free(iso.counts);
+    free(colors);
+    return found;
+}
+
+
+typedef struct {
+    device_t *dev;
+    const core_adjacency_t *adj;
+    const core_t *table_core;
+    int num_sources;
+    atomic_int next_source;
+    int *worker_queues;
+} distance_bfs_t;
+
+
+// Breadth-first search from every qubit of every distinct core, written straight into the tables
+static void device_distance_bfs_worker(void *arg, int worker_id) {
+    distance_bfs_t *bfs = arg;
+    device_t *dev = bfs->dev;
+    const int cap = dev->core_capacity;
+    int *queue = &bfs->worker_queues[worker_id * cap];
+
+    for (;;) {
+        int source = atomic_fetch_add_explicit(&bfs->next_source, 1, memory_order_relaxed);
+        if (source >= bfs->num_sources) break;
+        int t = source / cap, src = source % cap;
+        core_t c = bfs->table_core[t];
+        const int *offsets = &bfs->adj->offsets[c * (cap + 1)];
+        const int *neighbors = &bfs->adj->neighbors[bfs->adj->core_edge_start[c]];
+        device_dist_t *row = &dev->distance_tables[((size_t)t * cap + src) * cap];
+
+        for (int i = 0; i < cap; i++) row[i] = DEVICE_DIST_INF;
+        row[src] = 0;
+        int head = 0, tail = 0;
+        queue[tail++] = src;
+        while (head < tail) {
+            int u = queue[head++];
+            if (row[u] + 1 >= DEVICE_DIST_INF)
+                error("Core distance %d does not fit the distance tables, build with -DTS_WIDE_DISTANCES.", row[u] + 1);
+            for (int k = offsets[u]; k < offsets[u + 1]; k++) {
+                int v = neighbors[k];
+                if (row[v] != DEVICE_DIST_INF) continue;
+                row[v] = row[u] + 1;
+                queue[tail++] = v;
+            }
         }
     }
 }
 
 
 void device_calculate_distance_matrix(device_t *dev) {
-    if (dev->distance_matrix != NULL) {
-        for (core_t c = 0; c < dev->num_cores; c++) {
-            for (pqubit_t i = 0; i < dev->core_capacity; i++) {
-                free(dev->distance_matrix[c][i]);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const int cap = dev->core_capacity;
+    if (dev->distance_tables != NULL) free(dev->distance_tables);
+    if (dev->core_distances != NULL) free(dev->core_distances);
+    if (dev->qubit_local_index != NULL) free(dev->qubit_local_index);
+    if (dev->core_local_qubits != NULL) free(dev->core_local_qubits);
+
+    dev->qubit_local_index = malloc(sizeof(int) * dev->num_qubits);
+    dev->core_local_qubits = malloc(sizeof(pqubit_t) * dev->num_qubits);
+    dev->core_distances = malloc(sizeof(device_dist_t*) * dev->num_cores);
+    check_alloc(3, dev->qubit_local_index, dev->core_local_qubits, dev->core_distances);
+    for (core_t c = 0; c < dev->num_cores; c++)
+        for (int i = 0; i < cap; i++)
+            dev->qubit_local_index[dev->core_qubits[c][i]] = i;
+
+    // Intra-core adjacency lists by position in the core
+    core_adjacency_t adj;
+    adj.offsets = calloc((size_t)dev->num_cores * (cap + 1), sizeof(int));
+    adj.core_edge_start = calloc(dev->num_cores + 1, sizeof(int));
+    adj.neighbors = malloc(sizeof(int) * (2 * dev->num_edges + 1));
+    int *fill = calloc((size_t)dev->num_cores * cap, sizeof(int));
+    check_alloc(4, adj.offsets, adj.core_edge_start, adj.neighbors, fill);
+    for (int e = 0; e < dev->num_edges; e++) {
+        core_t c = dev->phys_to_core[dev->edges[e].p1];
+        if (c != dev->phys_to_core[dev->edges[e].p2]) continue;
+        adj.offsets[c * (cap + 1) + dev->qubit_local_index[dev->edges[e].p1] + 1]++;
+        adj.offsets[c * (cap + 1) + dev->qubit_local_index[dev->edges[e].p2] + 1]++;
+    }
+    for (core_t c = 0; c < dev->num_cores; c++) {
+        int *offsets = &adj.offsets[c * (cap + 1)];
+        for (int i = 0; i < cap; i++) offsets[i + 1] += offsets[i];
+        adj.core_edge_start[c + 1] = adj.core_edge_start[c] + offsets[cap];
+    }
+    for (int e = 0; e < dev->num_edges; e++) {
+        core_t c = dev->phys_to_core[dev->edges[e].p1];
+        if (c != dev->phys_to_core[dev->edges[e].p2]) continue;
+        int i = dev->qubit_local_index[dev->edges[e].p1];
+        int j = dev->qubit_local_index[dev->edges[e].p2];
+        int *neighbors = &adj.neighbors[adj.core_edge_start[c]];
+        neighbors[adj.offsets[c * (cap + 1) + i] + fill[c * cap + i]++] = j;
+        neighbors[adj.offsets[c * (cap + 1) + j] + fill[c * cap + j]++] = i;
+    }
+    free(fill);
+    for (core_t c = 0; c < dev->num_cores; c++) {
+        const int *offsets = &adj.offsets[c * (cap + 1)];
+        int *neighbors = &adj.neighbors[adj.core_edge_start[c]];
+        for (int i = 0; i < cap; i++)
+            qsort(&neighbors[offsets[i]], offsets[i + 1] - offsets[i], sizeof(int), compare_ints);
+    }
+
+    // Cores with the same adjacency share a table, isomorphic ones share it through their local index
+    int *core_table = malloc(sizeof(int) * dev->num_cores);
+    core_t *table_core = malloc(sizeof(core_t) * dev->num_cores);
+    int *mapping = malloc(sizeof(int) * cap);
+    check_alloc(3, core_table, table_core, mapping);
+    dev->num_distance_tables = 0;
+    int num_isomorphic_cores = 0;
+    for (core_t c = 0; c < dev->num_cores; c++) {
+        core_table[c] = -1;
+        for (int i = 0; i < cap; i++) mapping[i] = i;
+        int num_neighbors = adj.core_edge_start[c + 1] - adj.core_edge_start[c];
+        for (int t = 0; t < dev->num_distance_tables && core_table[c] == -1; t++) {
+            core_t r = table_core[t];
+            if (num_neighbors == adj.core_edge_start[r + 1] - adj.core_edge_start[r] &&
+                memcmp(&adj.offsets[c * (cap + 1)], &adj.offsets[r * (cap + 1)], sizeof(int) * (cap + 1)) == 0 &&
+                memcmp(&adj.neighbors[adj.core_edge_start[c]], &adj.neighbors[adj.core_edge_start[r]], sizeof(int) * num_neighbors) == 0)
+                core_table[c] = t;
+        }
+        for (int t = 0; t < dev->num_distance_tables && core_table[c] == -1; t++) {
+            if (device_find_core_isomorphism(dev, &adj, c, table_core[t], mapping)) {
+                core_table[c] = t;
+                num_isomorphic_cores++;
+            } else {
+                for (int i = 0; i < cap; i++) mapping[i] = i;
             }
-            free(dev->distance_matrix[c]);
         }
-        free(dev->distance_matrix);
+        if (core_table[c] == -1) {
+            table_core[dev->num_distance_tables] = c;
+            core_table[c] = dev->num_distance_tables++;
+        }
+        for (int i = 0; i < cap; i++) {
+            dev->qubit_local_index[dev->core_qubits[c][i]] = mapping[i];
+            dev->core_local_qubits[c * cap + mapping[i]] = dev->core_qubits[c][i];
+        }
     }
 
-    dev->distance_matrix = malloc(sizeof(int**) * dev->num_cores);
-    int (*edges)[3] = malloc(sizeof(int) * dev->num_edges * 3);
-    for (core_t c = 0; c < dev->num_cores; c++) {
-        // Build edge list
-        int core_edges = 0;
-        pqubit_t p_offset = dev->core_qubits[c][0];
-        for (int e = 0; e < dev->num_edges; e++) {
-            if (dev->phys_to_core[dev->edges[e].p1] == c && dev->phys_to_core[dev->edges[e].p2] == c) {
-                edges[core_edges][0] = dev->edges[e].p1 - p_offset;
-                edges[core_edges][1] = dev->edges[e].p2 - p_offset;
-                edges[core_edges][2] = 1;
-                core_edges++;
+    dev->distance_tables = malloc(sizeof(device_dist_t) * dev->num_distance_tables * cap * cap);
+    check_alloc(1, dev->distance_tables);
+    for (core_t c = 0; c < dev->num_cores; c++)
+        dev->core_distances[c] = &dev->distance_tables[(size_t)core_table[c] * cap * cap];
+
+    // BFS from every qubit of every distinct core, on all processors when there is enough work
+    distance_bfs_t bfs = {.dev = dev, .adj = &adj, .table_core = table_core, .num_sources = dev->num_distance_tables * cap};
+    atomic_init(&bfs.next_source, 0);
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1 || (size_t)bfs.num_sources * cap < TS_DEVICE_PARALLEL_MIN_WORK) num_workers = 1;
+    if (num_workers > bfs.num_sources) num_workers = bfs.num_sources;
+    bfs.worker_queues = malloc(sizeof(int) * num_workers * cap);
+    check_alloc(1, bfs.worker_queues);
+    if (num_workers > 1) {
+        thread_pool_t *pool = thread_pool_new((int)num_workers);
+        thread_pool_run(pool, device_distance_bfs_worker, &bfs);
+        thread_pool_free(pool);
+    } else {
+        device_distance_bfs_worker(&bfs, 0);
+    }
+    free(bfs.worker_queues);
+
+    int max_distance = 0;
+    for (size_t k = 0; k < (size_t)dev->num_distance_tables * cap * cap; k++)
+        if (dev->distance_tables[k] != DEVICE_DIST_INF && dev->distance_tables[k] > max_distance)
+            max_distance = dev->distance_tables[k];
+
+    free(adj.offsets);
+    free(adj.core_edge_start);
+    free(adj.neighbors);
+    free(core_table);
+    free(table_core);
+    free(mapping);
+
+    // Group the qubits of each core by distance from every qubit of the core
+    if (dev->distance_rings != NULL) free(dev->distance_rings);
+    dev->core_mask_words = (cap + 63) / 64;
+    dev->num_distance_rings = max_distance + 2;
+    dev->distance_rings = calloc((size_t)dev->num_qubits * dev->num_distance_rings * dev->core_mask_words, sizeof(uint64_t));
+    check_alloc(1, dev->distance_rings);
+    for (pqubit_t p = 0; p < dev->num_qubits; p++) {
+        const device_dist_t *dist = &dev->core_distances[dev->phys_to_core[p]][dev->qubit_local_index[p] * cap];
+        for (int i = 0; i < cap; i++) {
+            int d = dist[i] == DEVICE_DIST_INF ? max_distance + 1 : dist[i];
+            uint64_t *ring = &dev->distance_rings[((size_t)p * dev->num_distance_rings + d) * dev->core_mask_words];
+            ring[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+
+    // Order the qubits of each comm qubit's core by distance from it, then by physical id
+    if (dev->nearest_free_order != NULL) free(dev->nearest_free_order);
+    dev->nearest_free_order = malloc(sizeof(pqubit_t) * (dev->num_comm_qubits * cap + 1));
+    check_alloc(1, dev->nearest_free_order);
+    for (int i = 0; i < dev->num_comm_qubits; i++) {
+        pqubit_t p_comm = dev->comm_qubits[i];
+        const pqubit_t *core_qubits = dev->core_qubits[dev->phys_to_core[p_comm]];
+        pqubit_t *order = &dev->nearest_free_order[i * cap];
+        for (int j = 0; j < cap; j++) {
+            pqubit_t p = core_qubits[j];
+            int d = device_get_distance(dev, p_comm, p);
+            int k = j;
+            for (; k > 0; k--) {
+                int d_prev = device_get_distance(dev, p_comm, order[k - 1]);
+                if (d_prev < d || (d_prev == d && order[k - 1] < p)) break;
+                order[k] = order[k - 1];
             }
+            order[k] = p;
         }
-        // Use Floyd-Warshall algorithm to calculate distances O(num_cores*(num_qubits_in_core^3))
-        // In theory you don't need to do it everytime but once for each device
-        dev->distance_matrix[c] = floyd_warshall(dev->core_capacity, edges, core_edges);
     }
-    free(edges);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    log_printf(LOG_SUMMARY, "Computed %d distance table(s) for %d cores (%d isomorphic) on %ld thread(s) in %.2f ms\n", 
+           dev->num_distance_tables, dev->num_cores, num_isomorphic_cores, num_workers, elapsed_ms);
 }
 
 
@@ -286,12 +642,12 @@ int device_get_distance(const device_t* device, pqubit_t p1, pqubit_t p2) {
     core_t c1 = device->phys_to_core[p1];
     core_t c2 = device->phys_to_core[p2];
 
-    if (c1 == c2) {
-        pqubit_t p_offset = device->core_qubits[c1][0];
-        return device->distance_matrix[c1][p1 - p_offset][p2 - p_offset];
-    } else {
-        return TS_INF;
-    }
+    if (c1 != c2) return TS_INF;
+
+    int i = device->qubit_local_index[p1];
+    int j = device->qubit_local_index[p2];
+    device_dist_t d = device->core_distances[c1][i * device->core_capacity + j];
+    return d == DEVICE_DIST_INF ? TS_INF : d;
 }
 
 
@@ -303,6 +659,7 @@ void device_print(const device_t* dev) {
     printf(HBLU"  Number of edges:"CRESET" %d\n", dev->num_edges);
     printf(HBLU"  Number of teleport edges:"CRESET" %d\n", dev->num_tp_edges);
     printf(HBLU"  Number of inter-core edges:"CRESET" %d\n", dev->num_intercore_edges);
+    printf(HBLU"  Distinct core distance tables:"CRESET" %d\n", dev->num_distance_tables);
 
     // Intercore edges
     printf(HBLU"  Inter-core edges:"CRESET);
@@ -322,27 +679,24 @@ void device_free(device_t* dev) {
     }
     if (dev->inter_core_edges != NULL) free(dev->inter_core_edges);
     if (dev->edges != NULL) free(dev->edges);
-    if (dev->qubit_to_edges != NULL) {
-        for (pqubit_t i = 0; i < dev->num_qubits; i++)
-            if (dev->qubit_to_edges[i] != NULL) free(dev->qubit_to_edges[i]);
-        free(dev->qubit_to_edges);
-    }
+    if (dev->qubit_edge_offsets != NULL) free(dev->qubit_edge_offsets);
+    if (dev->qubit_neighbors != NULL) free(dev->qubit_neighbors);
     if (dev->tp_edges != NULL) free(dev->tp_edges);
+    if (dev->tp_edge_offsets != NULL) free(dev->tp_edge_offsets);
 
     if (dev->comm_qubits != NULL) free(dev->comm_qubits);
     if (dev->core_comm_qubits != NULL) free(dev->core_comm_qubits);
+    if (dev->core_comm_qubits_storage != NULL) free(dev->core_comm_qubits_storage);
     if (dev->core_num_comm_qubits != NULL) free(dev->core_num_comm_qubits);
     if (dev->qubit_is_comm != NULL) free(dev->qubit_is_comm);
+    if (dev->comm_qubit_node_id != NULL) free(dev->comm_qubit_node_id);
 
-    if (dev->distance_matrix != NULL) {
-        for (core_t c = 0; c < dev->num_cores; c++) {
-            for (pqubit_t i = 0; i < dev->core_capacity; i++) {
-                free(dev->distance_matrix[c][i]);
-            }
-            free(dev->distance_matrix[c]);
-        }
-        free(dev->distance_matrix);
-    }
+    if (dev->distance_tables != NULL) free(dev->distance_tables);
+    if (dev->core_distances != NULL) free(dev->core_distances);
+    if (dev->qubit_local_index != NULL) free(dev->qubit_local_index);
+    if (dev->core_local_qubits != NULL) free(dev->core_local_qubits);
+    if (dev->distance_rings != NULL) free(dev->distance_rings);
+    if (dev->nearest_free_order != NULL) free(dev->nearest_free_order);
 
     if (dev->json) cJSON_Delete(dev->json);
 
@@ -364,7 +718,7 @@ device_t* device_a() {
     dev->inter_core_edges[2] = (device_edge_t){.p1 = 7, .p2 = 19};
     dev->inter_core_edges[3] = (device_edge_t){.p1 = 23, .p2 = 30};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 3x3Q");
     return dev;
@@ -380,7 +734,7 @@ device_t* device_b() {
     dev->inter_core_edges[0] = (device_edge_t){.p1 = 3, .p2 = 4};
     dev->inter_core_edges[1] = (device_edge_t){.p1 = 7, .p2 = 8};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 3x1Q");
     return dev;
@@ -418,7 +772,7 @@ device_t* device_c() {
     dev->inter_core_edges[22] = (device_edge_t){.p1 = 51, .p2 = 72};
     dev->inter_core_edges[23] = (device_edge_t){.p1 = 53, .p2 = 74};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "3x3C 3x3Q");
     return dev;
@@ -443,7 +797,7 @@ device_t* device_d() {
     dev->inter_core_edges[2] = (device_edge_t){.p1 = 7, .p2 = 13};
     dev->inter_core_edges[3] = (device_edge_t){.p1 = 11, .p2 = 14};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 2x2Q");
     return dev;
@@ -472,7 +826,7 @@ device_t* device_e() {
     dev->inter_core_edges[2] = (device_edge_t){.p1 = 30, .p2 = 50};
     dev->inter_core_edges[3] = (device_edge_t){.p1 = 43, .p2 = 56};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 4x4Q - E");
     return dev;
@@ -506,7 +860,7 @@ device_t* device_f() {
     dev->inter_core_edges[6] = (device_edge_t){.p1 = 39, .p2 = 52};
     dev->inter_core_edges[7] = (device_edge_t){.p1 = 47, .p2 = 60};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 4x4Q - F");
     return dev;
@@ -537,7 +891,7 @@ device_t* device_g() {
     dev->inter_core_edges[4] = (device_edge_t){.p1 = 15, .p2 = 48};
     dev->inter_core_edges[5] = (device_edge_t){.p1 = 28, .p2 = 35};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "2x2C 4x4Q - G");
     return dev;
@@ -569,7 +923,7 @@ device_t* device_h() {
     dev->inter_core_edges[5] = (device_edge_t){.p1 = 75, .p2 = 88};
     dev->inter_core_edges[6] = (device_edge_t){.p1 = 46, .p2 = 82};
 
-    device_update_qubit_to_edges(dev);
+    device_build_adjacency(dev);
     device_build_teleport_edges(dev);
     strcpy(dev->name, "3x2C 4x4Q - H");
     return dev;
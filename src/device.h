@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "json.h"
@@ -9,6 +10,18 @@ typedef int core_t;
 
 typedef int pqubit_t;
 
+#define TS_DEVICE_PARALLEL_MIN_WORK (1 << 20)  // Smaller distance precomputations run on one thread
+#define TS_DEVICE_ISO_BUDGET 256               // Search nodes spent matching a core against a known topology
+
+// Intra-core distances, unreachable pairs are DEVICE_DIST_INF
+#ifdef TS_WIDE_DISTANCES
+typedef uint16_t device_dist_t;
+#define DEVICE_DIST_INF UINT16_MAX
+#else
+typedef uint8_t device_dist_t;
+#define DEVICE_DIST_INF UINT8_MAX
+#endif
+
 typedef struct {
     pqubit_t p1;
     pqubit_t p2;
@@ -29,18 +42,36 @@ typedef struct {
     int num_cores;
     int core_capacity;
 
-    // distance_matrix[core][p1][p2] = distance between p1 and p2 in core
-    int*** distance_matrix;
+    // core_distances[core][i * core_capacity + j] = distance between the i-th and j-th qubit of core,
+    // cores with the same topology point to the same table in distance_tables
+    device_dist_t* distance_tables;
+    int num_distance_tables;
+    device_dist_t** core_distances;
+    int* qubit_local_index;       // Row of each qubit in the distance table of its core
+    pqubit_t* core_local_qubits;  // core_local_qubits[core * core_capacity + i] = qubit of core with local index i
+
+    // Qubits of the core of p at distance d from p, as a bitmask over core offsets:
+    // distance_rings[(p * num_distance_rings + d) * core_mask_words ...], unreachable qubits in the last ring
+    uint64_t* distance_rings;
+    int num_distance_rings;
+    int core_mask_words;  // 64-bit words in a per-core qubit bitmask
+
+    // Qubits of the core of each comm qubit by distance from it, ties by physical id:
+    // nearest_free_order[comm_qubit_id * core_capacity + i]
+    pqubit_t* nearest_free_order;
 
     device_edge_t* edges;
 
-    device_edge_t** qubit_to_edges;
-    int* qubit_num_edges;
+    // Neighbors of p are qubit_neighbors[qubit_edge_offsets[p]] up to qubit_edge_offsets[p + 1], in edge order
+    int* qubit_edge_offsets;
+    pqubit_t* qubit_neighbors;
 
     device_edge_t* inter_core_edges;
     int num_intercore_edges;
 
+    // Teleport edges grouped by mediator, those through p start at tp_edge_offsets[p]
     device_tp_edge_t* tp_edges;
+    int* tp_edge_offsets;
     int num_tp_edges;
 
     pqubit_t* comm_qubits;
@@ -50,7 +81,8 @@ typedef struct {
 
     pqubit_t** core_qubits;
 
-    pqubit_t** core_comm_qubits;
+    pqubit_t** core_comm_qubits;  // Point into core_comm_qubits_storage
+    pqubit_t* core_comm_qubits_storage;
     int* core_num_comm_qubits;
 
     core_t* phys_to_core;
@@ -63,7 +95,7 @@ device_t* device_new_grid(int core_x, int core_y, int qubit_x, int qubit_y);
 
 device_t* device_from_json(const char *filename);
 
-void device_update_qubit_to_edges(device_t* device);
+void device_build_adjacency(device_t* device);
 
 void device_build_teleport_edges(device_t* device);
 
@@ -73,6 +105,8 @@ bool device_has_edge(const device_t* device, pqubit_t p1, pqubit_t p2);
 
 int device_get_distance(const device_t* device, pqubit_t p1, pqubit_t p2);
 
+int device_get_degree(const device_t* device, pqubit_t p);
+
 void device_print(const device_t* device);
 
 void device_free(device_t* device);
@@ -31,19 +31,38 @@ void graph_add_edge(graph_t *graph, int u, int v, int w) {
 }
 
 
-void graph_increase_edge_weight(graph_t *graph, int u, int v, int w) {
+edge_t *graph_get_edge(graph_t *graph, int u, int v) {
     for (size_t i = 0; i < graph->adj[u].degree; ++i) {
         if (graph->adj[u].edges[i].to == v) {
-            graph->adj[u].edges[i].weight += w;
-            return;
+            return &graph->adj[u].edges[i];
         }
     }
     for (size_t i = 0; i < graph->adj[v].degree; ++i) {
         if (graph->adj[v].edges[i].to == u) {
-            graph->adj[v].edges[i].weight += w;
-            return;
+            return &graph->adj[v].edges[i];
         }
     }
+    return NULL;
+}
+
+
+void graph_increase_edge_weight(graph_t *graph, int u, int v, int w) {
+    edge_t *edge = graph_get_edge(graph, u, v);
+    if (edge) edge->weight += w;
+}
+
+
+void graph_truncate_node_edges(graph_t *graph, int node, size_t degree) {
+    if (degree < graph->adj[node].degree) graph->adj[node].degree = degree;
+}
+
+
+void graph_reserve_node_edges(graph_t *graph, int node, size_t capacity) {
+    adj_list_t *list = &graph->adj[node];
+    if (capacity <= list->capacity) return;
+    list->edges = realloc(list->edges, sizeof(edge_t) * capacity);
+    check_alloc(1, list->edges);
+    list->capacity = capacity;
 }
 
 
@@ -72,20 +91,151 @@ void graph_increase_node_weight(graph_t *graph, int node, int weight) {
 
 
 path_t *graph_dijkstra(const graph_t *graph, int src, int dst) {
+    dijkstra_scratch_t *scratch = dijkstra_scratch_new(graph->num_nodes);
+    path_t *result = path_new(graph->num_nodes);
+    graph_dijkstra_into(graph, src, dst, scratch, result);
+    dijkstra_scratch_free(scratch);
+    return result;
+}
+
+
+static void dijkstra_write_path(const int *dist, const int *prev, int dst, path_t *path_out) {
+    if (dist[dst] != TS_INF) {
+        size_t len = 0;
+        for (int cur = dst; cur != -1; cur = prev[cur]) ++len;
+        int cur = dst;
+        for (size_t i = len; i > 0; i--) {
+            path_out->nodes[i - 1] = cur;
+            if (i != 1) {
+                path_out->distances[i - 2] = dist[cur] - dist[prev[cur]];
+            }
+            cur = prev[cur];
+        }
+
+        path_out->length = len;
+        path_out->distance = dist[dst];
+    } else {
+        path_out->length = 0;
+        path_out->distance = TS_INF;
+    }
+}
+
+
+static void dijkstra_reset(const graph_t *graph, dijkstra_scratch_t *scratch, path_t *path_out) {
     size_t N = graph->num_nodes;
-    int *dist = malloc(sizeof(int) * N);
-    int *prev = malloc(sizeof(int) * N);
-    bool *visited = calloc(N, sizeof(bool));
-    check_alloc(3, dist, prev, visited);
+    if (N > scratch->num_nodes || N > path_out->capacity) 
+        error("Dijkstra buffers too small for graph with %zu nodes.", N);
 
     for (size_t i = 0; i < N; ++i) {
-        dist[i] = TS_INF;
-        prev[i] = -1;
+        scratch->dist[i] = TS_INF;
+        scratch->prev[i] = -1;
+        scratch->visited[i] = false;
+        scratch->in_bucket[i] = false;
     }
+    heap_clear(scratch->heap);
+}
+
+
+static inline void dijkstra_bucket_link(dijkstra_scratch_t *scratch, int node, int key) {
+    int *head = &scratch->bucket_head[key & (DIJKSTRA_NUM_BUCKETS - 1)];
+    scratch->bucket_prev[node] = -1;
+    scratch->bucket_next[node] = *head;
+    if (*head != -1) scratch->bucket_prev[*head] = node;
+    *head = node;
+    scratch->in_bucket[node] = true;
+}
+
+
+static inline void dijkstra_bucket_unlink(dijkstra_scratch_t *scratch, int node, int key) {
+    int next = scratch->bucket_next[node];
+    int prev = scratch->bucket_prev[node];
+    if (prev != -1) scratch->bucket_next[prev] = next;
+    else scratch->bucket_head[key & (DIJKSTRA_NUM_BUCKETS - 1)] = next;
+    if (next != -1) scratch->bucket_prev[next] = prev;
+    scratch->in_bucket[node] = false;
+}
+
+
+// Dial's algorithm: nodes with keys in [base, base + DIJKSTRA_NUM_BUCKETS) sit in circular buckets,
+// farther keys wait in the heap until the buckets run empty and the window moves to the heap minimum.
+void graph_dijkstra_into(const graph_t *graph, int src, int dst, dijkstra_scratch_t *scratch, path_t *path_out) {
+    dijkstra_reset(graph, scratch, path_out);
+
+    int *dist = scratch->dist;
+    int *prev = scratch->prev;
+    bool *visited = scratch->visited;
+    heap_t *heap = scratch->heap;
+
+    for (int b = 0; b < DIJKSTRA_NUM_BUCKETS; ++b)
+        scratch->bucket_head[b] = -1;
+
     dist[src] = graph->node_weights[src];
+    int base = dist[src];
+    int limit = base + DIJKSTRA_NUM_BUCKETS;
+    int cur = base;
+    int num_bucketed = 0;
+    if (dist[src] < TS_INF) {
+        dijkstra_bucket_link(scratch, src, dist[src]);
+        num_bucketed++;
+    }
 
-    heap_t *heap = heap_new(N);
-    check_alloc(4, heap, dist, prev, visited);
+    while (true) {
+        if (num_bucketed == 0) {
+            if (heap_is_empty(heap)) break;
+            base = heap_get_min(heap).priority;
+            limit = base + DIJKSTRA_NUM_BUCKETS;
+            cur = base;
+            while (!heap_is_empty(heap) && heap_get_min(heap).priority < limit) {
+                heap_item_t item = heap_extract_min(heap);
+                dijkstra_bucket_link(scratch, item.id, item.priority);
+                num_bucketed++;
+            }
+        }
+
+        int u;
+        while ((u = scratch->bucket_head[cur & (DIJKSTRA_NUM_BUCKETS - 1)]) == -1) cur++;
+        dijkstra_bucket_unlink(scratch, u, cur);
+        num_bucketed--;
+
+        visited[u] = true;
+        if (u == dst) break;
+        adj_list_t *adj = &graph->adj[u];
+        for (size_t i = 0; i < adj->degree; ++i) {
+            int v = adj->edges[i].to;
+            if (visited[v]) continue;
+            int new_dist = dist[u] + adj->edges[i].weight + graph->node_weights[v];
+            if (new_dist >= dist[v]) continue;
+
+            if (scratch->in_bucket[v]) {
+                dijkstra_bucket_unlink(scratch, v, dist[v]);
+                num_bucketed--;
+            }
+            dist[v] = new_dist;
+            prev[v] = u;
+            if (new_dist < limit) {
+                heap_remove(heap, v);
+                dijkstra_bucket_link(scratch, v, new_dist);
+                num_bucketed++;
+            } else {
+                heap_insert(heap, v, new_dist);
+            }
+        }
+    }
+
+    dijkstra_write_path(dist, prev, dst, path_out);
+}
+
+
+// Binary heap Dijkstra, kept as a reference for the bucket queue version
+void graph_dijkstra_heap_into(const graph_t *graph, int src, int dst, dijkstra_scratch_t *scratch, path_t *path_out) {
+    dijkstra_reset(graph, scratch, path_out);
+
+    int *dist = scratch->dist;
+    int *prev = scratch->prev;
+    bool *visited = scratch->visited;
+    heap_t *heap = scratch->heap;
+
+    dist[src] = graph->node_weights[src];
     heap_insert(heap, src, dist[src]);
 
     while (!heap_is_empty(heap)) {
@@ -108,38 +258,39 @@ path_t *graph_dijkstra(const graph_t *graph, int src, int dst) {
         }
     }
 
-    path_t *result = malloc(sizeof(path_t));
-    check_alloc(4, result, dist, prev, visited);
+    dijkstra_write_path(dist, prev, dst, path_out);
+}
 
-    if (dist[dst] != TS_INF) {
-        size_t len = 0;
-        for (int cur = dst; cur != -1; cur = prev[cur]) ++len;
-        result->nodes = malloc(sizeof(int) * len);
-        result->distances = malloc(sizeof(int) * (len-1));
-        check_alloc(5, result->nodes, result, dist, prev, visited);
-        int cur = dst;
-        for (size_t i = len; i > 0; i--) {
-            result->nodes[i - 1] = cur;
-            if (i != 1) {
-                result->distances[i - 2] = dist[cur] - dist[prev[cur]];
-            }
-            cur = prev[cur];
-        }
 
-        
-        result->length = len;
-        result->distance = dist[dst];
-    } else {
-        result->nodes = NULL;
-        result->length = 0;
-        result->distance = TS_INF;
-    }
+dijkstra_scratch_t *dijkstra_scratch_new(size_t num_nodes) {
+    dijkstra_scratch_t *scratch = malloc(sizeof(dijkstra_scratch_t));
+    check_alloc(1, scratch);
+    scratch->dist = malloc(sizeof(int) * num_nodes);
+    scratch->prev = malloc(sizeof(int) * num_nodes);
+    scratch->visited = malloc(sizeof(bool) * num_nodes);
+    scratch->heap = heap_new(num_nodes);
+    scratch->in_bucket = malloc(sizeof(bool) * num_nodes);
+    scratch->bucket_next = malloc(sizeof(int) * num_nodes);
+    scratch->bucket_prev = malloc(sizeof(int) * num_nodes);
+    scratch->bucket_head = malloc(sizeof(int) * DIJKSTRA_NUM_BUCKETS);
+    check_alloc(8, scratch->dist, scratch->prev, scratch->visited, scratch->heap,
+                scratch->in_bucket, scratch->bucket_next, scratch->bucket_prev, scratch->bucket_head);
+    scratch->num_nodes = num_nodes;
+    return scratch;
+}
 
-    heap_free(heap);
-    free(dist);
-    free(prev);
-    free(visited);
-    return result;
+
+void dijkstra_scratch_free(dijkstra_scratch_t *scratch) {
+    if (!scratch) return;
+    free(scratch->dist);
+    free(scratch->prev);
+    free(scratch->visited);
+    heap_free(scratch->heap);
+    free(scratch->in_bucket);
+    free(scratch->bucket_next);
+    free(scratch->bucket_prev);
+    free(scratch->bucket_head);
+    free(scratch);
 }
 
 
@@ -202,6 +353,19 @@ void graph_free(graph_t *graph) {
 }
 
 
+path_t *path_new(size_t capacity) {
+    path_t *path = malloc(sizeof(path_t));
+    check_alloc(1, path);
+    path->nodes = malloc(sizeof(node_t) * capacity);
+    path->distances = malloc(sizeof(int) * capacity);
+    check_alloc(2, path->nodes, path->distances);
+    path->length = 0;
+    path->distance = TS_INF;
+    path->capacity = capacity;
+    return path;
+}
+
+
 path_t *path_copy(const path_t *src) {
     if (!src) return NULL;
 
@@ -209,6 +373,7 @@ path_t *path_copy(const path_t *src) {
 
     copy->length = src->length;
     copy->distance = src->distance;
+    copy->capacity = src->length;
 
     if (src->length == 0) {
         copy->nodes = NULL;
@@ -231,6 +396,17 @@ path_t *path_copy(const path_t *src) {
 }
 
 
+void path_copy_into(path_t *dst, const path_t *src) {
+    if (src->length > dst->capacity)
+        error("Path of length %zu does not fit in a path of capacity %zu.", src->length, dst->capacity);
+    memcpy(dst->nodes, src->nodes, sizeof(node_t) * src->length);
+    if (src->length > 1)
+        memcpy(dst->distances, src->distances, sizeof(int) * (src->length - 1));
+    dst->length = src->length;
+    dst->distance = src->distance;
+}
+
+
 void path_free(path_t *path) {
     if (!path) return;
     free(path->nodes);
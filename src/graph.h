@@ -1,9 +1,16 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "heap.h"
+
 typedef int node_t;
 
+// Width of the bucket window of graph_dijkstra_into, a power of two. Keys past the window
+// go to the heap, so any non-negative weights work, but the usual ones should fit.
+#define DIJKSTRA_NUM_BUCKETS 64
+
 typedef struct {
     node_t to;
     int weight;
@@ -20,6 +27,7 @@ typedef struct {
     size_t length;
     int *distances;
     int distance;
+    size_t capacity;  // Allocated nodes, a path can be refilled up to this length
 } path_t;
 
 typedef struct {
@@ -28,6 +36,19 @@ typedef struct {
     int *node_weights;
 } graph_t;
 
+// Buffers of a shortest path search, reused across searches on graphs of up to num_nodes nodes
+typedef struct {
+    int *dist;
+    int *prev;
+    bool *visited;
+    heap_t *heap;
+    bool *in_bucket;
+    int *bucket_next;
+    int *bucket_prev;
+    int *bucket_head;
+    size_t num_nodes;
+} dijkstra_scratch_t;
+
 
 graph_t *graph_new(size_t num_nodes);
 
@@ -37,8 +58,14 @@ void graph_add_directed_edge(graph_t *graph, int u, int v, int w);
 
 void graph_add_edge(graph_t *graph, int u, int v, int w);
 
+edge_t *graph_get_edge(graph_t *graph, int u, int v);
+
 void graph_increase_edge_weight(graph_t *graph, int u, int v, int w);
 
+void graph_truncate_node_edges(graph_t *graph, int node, size_t degree);
+
+void graph_reserve_node_edges(graph_t *graph, int node, size_t capacity);
+
 void graph_increase_node_edges_weights(graph_t *graph, int node, int weight);
 
 void graph_set_node_weight(graph_t *graph, int node, int weight);
@@ -47,10 +74,22 @@ void graph_increase_node_weight(graph_t *graph, int node, int weight);
 
 path_t *graph_dijkstra(const graph_t *graph, int src, int dst);
 
+void graph_dijkstra_into(const graph_t *graph, int src, int dst, dijkstra_scratch_t *scratch, path_t *path_out);
+
+void graph_dijkstra_heap_into(const graph_t *graph, int src, int dst, dijkstra_scratch_t *scratch, path_t *path_out);
+
+dijkstra_scratch_t *dijkstra_scratch_new(size_t num_nodes);
+
+void dijkstra_scratch_free(dijkstra_scratch_t *scratch);
+
 void graph_print(const graph_t *graph, const int *node_ids_translation);
 
 graph_t *graph_copy(const graph_t *src);
 
+path_t *path_new(size_t capacity);
+
 path_t *path_copy(const path_t *src);
 
+void path_copy_into(path_t *dst, const path_t *src);
+
 void path_free(path_t *path);
\ No newline at end of file
@@ -65,13 +65,13 @@ heap_t *heap_new(size_t capacity) {
     heap_t *heap = malloc(sizeof(heap_t));
     check_alloc(1, heap);
 
-    heap->data = malloc(sizeof(heap_item_t) * capacity);
-    heap->pos = malloc(sizeof(int) * capacity);
+    heap->capacity = capacity > 4 ? capacity : 4;
+    heap->data = malloc(sizeof(heap_item_t) * heap->capacity);
+    heap->pos = malloc(sizeof(int) * heap->capacity);
     check_alloc(2, heap->data, heap->pos);
 
-    heap->capacity = capacity > 4 ? capacity : 4;
     heap->size = 0;
-    for (size_t i = 0; i < capacity; ++i)
+    for (size_t i = 0; i < heap->capacity; ++i)
         heap->pos[i] = -1;
     return heap;
 }
@@ -102,6 +102,19 @@ heap_t *heap_copy(const heap_t *src) {
     return copy;
 }
 
+void heap_copy_into(heap_t *dst, const heap_t *src) {
+    if (dst->capacity != src->capacity) {
+        dst->data = realloc(dst->data, sizeof(heap_item_t) * src->capacity);
+        dst->pos = realloc(dst->pos, sizeof(int) * src->capacity);
+        check_alloc(2, dst->data, dst->pos);
+        dst->capacity = src->capacity;
+    }
+
+    dst->size = src->size;
+    memcpy(dst->data, src->data, sizeof(heap_item_t) * src->size);
+    memcpy(dst->pos, src->pos, sizeof(int) * src->capacity);
+}
+
 void heap_insert(heap_t *heap, int id, int priority) {
     if (id < 0) error("Tried to insert item with negative id %d in a heap.", id);
 
@@ -161,6 +174,12 @@ heap_item_t heap_extract_min(heap_t *heap) {
     return min;
 }
 
+void heap_clear(heap_t *heap) {
+    for (size_t i = 0; i < heap->size; ++i)
+        heap->pos[heap->data[i].id] = -1;
+    heap->size = 0;
+}
+
 int heap_is_empty(const heap_t *heap) {
     return heap->size == 0;
-}
\ No newline at end of file
+}
@@ -21,6 +21,8 @@ void heap_free(heap_t* heap);
 
 heap_t* heap_copy(const heap_t* src);
 
+void heap_copy_into(heap_t* dst, const heap_t* src);
+
 void heap_insert(heap_t* heap, int id, int priority);
 
 void heap_remove(heap_t* heap, int id);
@@ -29,4 +31,6 @@ heap_item_t heap_get_min(const heap_t* heap);
 
 heap_item_t heap_extract_min(heap_t* heap);
 
+void heap_clear(heap_t* heap);
+
 int heap_is_empty(const heap_t* heap);
\ No newline at end of file
@@ -1,10 +1,10 @@
 #include "layout.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "circuit.h"
 #include "device.h"
-#include "heap.h"
 #include "utils.h"
 
 
@@ -12,6 +12,17 @@ bool layout_is_phys_free(const layout_t *layout, pqubit_t phys) {
     return layout->phys_to_virt[phys] >= layout->circuit->num_qubits;
 }
 
+// Sets the bit of phys in its core free mask to whether it currently holds no virtual qubit
+static void layout_update_free_bit(layout_t *layout, pqubit_t phys) {
+    const device_t *dev = layout->device;
+    core_t core = dev->phys_to_core[phys];
+    int i = dev->qubit_local_index[phys];
+    uint64_t *word = &layout->core_free_masks[core * dev->core_mask_words + i / 64];
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if (layout_is_phys_free(layout, phys)) *word |= bit;
+    else *word &= ~bit;
+}
+
 pqubit_t layout_get_phys(const layout_t *layout, vqubit_t virt) {
     return layout->virt_to_phys[virt];
 }
@@ -37,12 +48,7 @@ bool layout_can_execute_gate(const layout_t *layout, const gate_t *gate) {
     vqubit_t virt2 = gate->target_qubits[1];
     pqubit_t phys1 = layout->virt_to_phys[virt1];
     pqubit_t phys2 = layout->virt_to_phys[virt2];
-    core_t core1 = layout->device->phys_to_core[phys1];
-    core_t core2 = layout->device->phys_to_core[phys2];
-    if (core1 != core2) return false;
-
-    pqubit_t p_offset = layout->device->core_qubits[core1][0];
-    return layout->device->distance_matrix[core1][phys1 - p_offset][phys2 - p_offset] == 1;
+    return device_get_distance(layout->device, phys1, phys2) == 1;
 }
 
 bool layout_gate_is_separated(const layout_t *layout, const gate_t *gate) {
@@ -60,7 +66,7 @@ bool layout_gate_is_separated(const layout_t *layout, const gate_t *gate) {
     return core1 != core2;
 }
 
-void layout_apply_swap(layout_t *layout, pqubit_t phys1, pqubit_t phys2) {
+static void layout_swap_positions(layout_t *layout, pqubit_t phys1, pqubit_t phys2) {
     if (phys1 == phys2) {
         error("Cannot swap the same physical qubit %d.", phys1);
     }
@@ -77,26 +83,11 @@ void layout_apply_swap(layout_t *layout, pqubit_t phys1, pqubit_t phys2) {
     layout->virt_to_phys[virt1] = phys2;
     layout->virt_to_phys[virt2] = phys1;
 
-    core_t core = layout->device->phys_to_core[phys1];
-    pqubit_t p_offset = layout->device->core_qubits[core][0];
-
-    for (int i = 0; i < layout->device->core_num_comm_qubits[core]; i++) {
-        pqubit_t comm_qubit = layout->device->core_comm_qubits[core][i];
-        int pc_id = layout->device->comm_qubit_node_id[comm_qubit];
-
-        if (layout_is_phys_free(layout, phys1)) {
-            int new_distance_p1 = device_get_distance(layout->device, comm_qubit, phys1);
-            heap_insert(layout->nearest_free_qubits[pc_id], phys1 - p_offset, new_distance_p1);
-            heap_remove(layout->nearest_free_qubits[pc_id], phys2 - p_offset);
-        } else if (layout_is_phys_free(layout, phys2)) {
-            int new_distance_p2 = device_get_distance(layout->device, comm_qubit, phys2);
-            heap_insert(layout->nearest_free_qubits[pc_id], phys2 - p_offset, new_distance_p2);
-            heap_remove(layout->nearest_free_qubits[pc_id], phys1 - p_offset);
-        }
-    }
+    layout_update_free_bit(layout, phys1);
+    layout_update_free_bit(layout, phys2);
 }
 
-void layout_apply_teleport(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target) {
+static void layout_teleport_positions(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target) {
     if (layout_is_phys_free(layout, phys_source)) {
         error("Cannot teleport with empty source physical qubit %d.", phys_source);
     } else if (!layout_is_phys_free(layout, phys_mediator)) {
@@ -118,6 +109,38 @@ void layout_apply_teleport(layout_t *layout, pqubit_t phys_source, pqubit_t phys
     layout->core_remaining_capacities[core_source] += 1;
     layout->core_remaining_capacities[core_target] -= 1;
 
+    layout_update_free_bit(layout, phys_source);
+    layout_update_free_bit(layout, phys_target);
+}
+
+// Tracked heaps break ties by their insert and remove history, keep the order of these updates
+void layout_apply_swap(layout_t *layout, pqubit_t phys1, pqubit_t phys2) {
+    layout_swap_positions(layout, phys1, phys2);
+    if (layout->nearest_free_qubits == NULL) return;
+
+    core_t core = layout->device->phys_to_core[phys1];
+    pqubit_t p_offset = layout->device->core_qubits[core][0];
+
+    for (int i = 0; i < layout->device->core_num_comm_qubits[core]; i++) {
+        pqubit_t comm_qubit = layout->device->core_comm_qubits[core][i];
+        int pc_id = layout->device->comm_qubit_node_id[comm_qubit];
+
+        if (layout_is_phys_free(layout, phys1)) {
+            heap_insert(layout->nearest_free_qubits[pc_id], phys1 - p_offset, device_get_distance(layout->device, comm_qubit, phys1));
+            heap_remove(layout->nearest_free_qubits[pc_id], phys2 - p_offset);
+        } else if (layout_is_phys_free(layout, phys2)) {
+            heap_insert(layout->nearest_free_qubits[pc_id], phys2 - p_offset, device_get_distance(layout->device, comm_qubit, phys2));
+            heap_remove(layout->nearest_free_qubits[pc_id], phys1 - p_offset);
+        }
+    }
+}
+
+void layout_apply_teleport(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target) {
+    layout_teleport_positions(layout, phys_source, phys_mediator, phys_target);
+    if (layout->nearest_free_qubits == NULL) return;
+
+    core_t core_source = layout->device->phys_to_core[phys_source];
+    core_t core_target = layout->device->phys_to_core[phys_target];
     pqubit_t p_offset_source = layout->device->core_qubits[core_source][0];
     pqubit_t p_offset_target = layout->device->core_qubits[core_target][0];
 
@@ -136,25 +159,108 @@ void layout_apply_teleport(layout_t *layout, pqubit_t phys_source, pqubit_t phys
     }
 }
 
-pqubit_t layout_get_nearest_free_qubit(const layout_t *layout, int comm_qubit_id) {
+// Undoable moves leave the heaps alone: evaluations only read nearest free distances, and the 
+// undo brings back the layout the heaps describe
+void layout_apply_swap_undoable(layout_t *layout, pqubit_t phys1, pqubit_t phys2, layout_undo_t *undo) {
+    undo->phys1 = phys1;
+    undo->phys2 = phys2;
+    undo->core_freed = -1;
+    undo->core_filled = -1;
+
+    layout_swap_positions(layout, phys1, phys2);
+}
+
+void layout_apply_teleport_undoable(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target, layout_undo_t *undo) {
+    undo->phys1 = phys_source;
+    undo->phys2 = phys_target;
+    undo->core_freed = layout->device->phys_to_core[phys_source];
+    undo->core_filled = layout->device->phys_to_core[phys_target];
+
+    layout_teleport_positions(layout, phys_source, phys_mediator, phys_target);
+}
+
+void layout_undo(layout_t *layout, const layout_undo_t *undo) {
+    // Both swaps and teleports exchange two positions, exchanging them again restores the mapping
+    vqubit_t virt1 = layout->phys_to_virt[undo->phys1];
+    vqubit_t virt2 = layout->phys_to_virt[undo->phys2];
+    layout->phys_to_virt[undo->phys1] = virt2;
+    layout->phys_to_virt[undo->phys2] = virt1;
+    layout->virt_to_phys[virt1] = undo->phys2;
+    layout->virt_to_phys[virt2] = undo->phys1;
+
+    if (undo->core_freed != -1) {
+        layout->core_remaining_capacities[undo->core_freed] -= 1;
+        layout->core_remaining_capacities[undo->core_filled] += 1;
+    }
+
+    layout_update_free_bit(layout, undo->phys1);
+    layout_update_free_bit(layout, undo->phys2);
+}
+
+layout_undo_t *layout_undo_new() {
+    layout_undo_t *undo = malloc(sizeof(layout_undo_t));
+    check_alloc(1, undo);
+    *undo = (layout_undo_t){0};
+    return undo;
+}
+
+void layout_undo_free(layout_undo_t *undo) {
+    free(undo);
+}
+
+// Heap minimum if the layout tracks heaps, else the first free qubit in the distance order of 
+// the comm qubit. -1 if the core is full.
+static pqubit_t layout_find_nearest_free_qubit(const layout_t *layout, int comm_qubit_id) {
     const device_t *dev = layout->device;
-    core_t core = dev->phys_to_core[dev->comm_qubits[comm_qubit_id]];
-    heap_t *heap = layout->nearest_free_qubits[comm_qubit_id];
 
-    if (heap_is_empty(heap)) {
+    if (layout->nearest_free_qubits != NULL) {
+        const heap_t *heap = layout->nearest_free_qubits[comm_qubit_id];
+        if (heap_is_empty(heap)) return -1;
+        core_t core = dev->phys_to_core[dev->comm_qubits[comm_qubit_id]];
+        return heap_get_min(heap).id + dev->core_qubits[core][0];
+    }
+
+    const pqubit_t *order = &dev->nearest_free_order[comm_qubit_id * dev->core_capacity];
+    for (int i = 0; i < dev->core_capacity; i++)
+        if (layout_is_phys_free(layout, order[i])) return order[i];
+    return -1;
+}
+
+pqubit_t layout_get_nearest_free_qubit(const layout_t *layout, int comm_qubit_id) {
+    pqubit_t p_free = layout_find_nearest_free_qubit(layout, comm_qubit_id);
+    if (p_free == -1) {
         printf("No free qubits available for communication qubit %d\n", comm_qubit_id);
         exit(1);
-        return -1;  // No free qubits available
     }
+    return p_free;
+}
 
-    int p_free = heap_get_min(heap).id;
-    pqubit_t p_offset = dev->core_qubits[core][0];
-    return p_free + p_offset;
+// Closest distance ring of the comm qubit with a free qubit, ties do not matter here
+int layout_get_nearest_free_distance(const layout_t *layout, int comm_qubit_id) {
+    const device_t *dev = layout->device;
+    const int words = dev->core_mask_words;
+    pqubit_t p_comm = dev->comm_qubits[comm_qubit_id];
+    core_t core = dev->phys_to_core[p_comm];
+    const uint64_t *mask = &layout->core_free_masks[core * words];
+    const uint64_t *rings = &dev->distance_rings[(size_t)p_comm * dev->num_distance_rings * words];
+
+    for (int d = 0; d < dev->num_distance_rings - 1; d++)
+        for (int w = 0; w < words; w++)
+            if (mask[w] & rings[d * words + w]) return d;
+    return TS_INF;
 }
 
-void layout_init_nearest_free_qubits(layout_t *layout) {
+void layout_init_nearest_free_qubits(layout_t *layout, bool track_heaps) {
     const device_t *dev = layout->device;
+    memset(layout->core_free_masks, 0, sizeof(uint64_t) * dev->num_cores * dev->core_mask_words);
+    for (pqubit_t p = 0; p < dev->num_qubits; p++)
+        layout_update_free_bit(layout, p);
+
+    layout_free_nearest_free_heaps(layout);
+    if (!track_heaps) return;
+
     layout->nearest_free_qubits = malloc(sizeof(heap_t *) * dev->num_comm_qubits);
+    check_alloc(1, layout->nearest_free_qubits);
     for (int i = 0; i < dev->num_comm_qubits; i++) {
         heap_t *heap = heap_new(dev->core_capacity);
         pqubit_t p_comm = dev->comm_qubits[i];
@@ -162,22 +268,28 @@ void layout_init_nearest_free_qubits(layout_t *layout) {
         pqubit_t p_offset = dev->core_qubits[p_comm_core][0];  // offset for this core, assuming qubits are contiguous and ordered in each core
         for (int j = 0; j < dev->core_capacity; j++) {
             pqubit_t p = dev->core_qubits[p_comm_core][j];
-            if (layout_is_phys_free(layout, p)) {
-                int distance = device_get_distance(dev, p_comm, p);
-                printf("distance from comm qubit %d to physical qubit %d: %d\n", p_comm, p, distance);
-                heap_insert(heap, p - p_offset, distance);
-            }
+            if (layout_is_phys_free(layout, p))
+                heap_insert(heap, p - p_offset, device_get_distance(dev, p_comm, p));
         }
         layout->nearest_free_qubits[i] = heap;
-        printf("nearest free qubits for comm qubit %d: %d\n", i, heap_get_min(heap).id);
     }
 }
 
+void layout_free_nearest_free_heaps(layout_t *layout) {
+    if (layout->nearest_free_qubits == NULL) return;
+    for (int i = 0; i < layout->device->num_comm_qubits; i++) 
+        heap_free(layout->nearest_free_qubits[i]);
+    free(layout->nearest_free_qubits);
+    layout->nearest_free_qubits = NULL;
+}
+
 layout_t *layout_new(const device_t *device, const circuit_t *circuit) {
     layout_t *layout = malloc(sizeof(layout_t));
     layout->phys_to_virt = malloc(sizeof(vqubit_t) * device->num_qubits);
     layout->virt_to_phys = malloc(sizeof(pqubit_t) * device->num_qubits);
     layout->core_remaining_capacities = malloc(sizeof(int) * device->num_cores);
+    layout->core_free_masks = calloc(device->num_cores * device->core_mask_words, sizeof(uint64_t));
+    check_alloc(4, layout->phys_to_virt, layout->virt_to_phys, layout->core_remaining_capacities, layout->core_free_masks);
 
     for (pqubit_t p = 0; p < device->num_qubits; p++) {
         layout->phys_to_virt[p] = -1;
@@ -207,8 +319,12 @@ layout_t *layout_copy(const layout_t *layout) {
     memcpy(new_layout->virt_to_phys, layout->virt_to_phys, sizeof(pqubit_t) * device->num_qubits);
     memcpy(new_layout->core_remaining_capacities, layout->core_remaining_capacities, sizeof(int) * device->num_cores);
 
+    new_layout->core_free_masks = malloc(sizeof(uint64_t) * device->num_cores * device->core_mask_words);
+    memcpy(new_layout->core_free_masks, layout->core_free_masks, sizeof(uint64_t) * device->num_cores * device->core_mask_words);
+
     if (layout->nearest_free_qubits != NULL) {
         new_layout->nearest_free_qubits = malloc(sizeof(heap_t *) * device->num_comm_qubits);
+        check_alloc(1, new_layout->nearest_free_qubits);
         for (int i = 0; i < device->num_comm_qubits; i++) 
             new_layout->nearest_free_qubits[i] = heap_copy(layout->nearest_free_qubits[i]);
     } else {
@@ -221,16 +337,29 @@ layout_t *layout_copy(const layout_t *layout) {
     return new_layout;
 }
 
+// Overwrites dst with src without allocating, both must be layouts of the same device
+void layout_copy_into(layout_t *dst, const layout_t *src) {
+    const device_t *device = src->device;
+
+    memcpy(dst->phys_to_virt, src->phys_to_virt, sizeof(vqubit_t) * device->num_qubits);
+    memcpy(dst->virt_to_phys, src->virt_to_phys, sizeof(pqubit_t) * device->num_qubits);
+    memcpy(dst->core_remaining_capacities, src->core_remaining_capacities, sizeof(int) * device->num_cores);
+
+    memcpy(dst->core_free_masks, src->core_free_masks, sizeof(uint64_t) * device->num_cores * device->core_mask_words);
+
+    if (src->nearest_free_qubits != NULL && dst->nearest_free_qubits != NULL) {
+        for (int i = 0; i < device->num_comm_qubits; i++) 
+            heap_copy_into(dst->nearest_free_qubits[i], src->nearest_free_qubits[i]);
+    }
+}
+
 void layout_free(layout_t *layout) {
     free(layout->phys_to_virt);
     free(layout->virt_to_phys);
     free(layout->core_remaining_capacities);
 
-    if (layout->nearest_free_qubits != NULL) {
-        for (int i = 0; i < layout->device->num_comm_qubits; i++) 
-            heap_free(layout->nearest_free_qubits[i]);
-        free(layout->nearest_free_qubits);
-    }
+    free(layout->core_free_masks);
+    layout_free_nearest_free_heaps(layout);
 
     free(layout);
 }
@@ -266,21 +395,16 @@ void layout_print(const layout_t *layout) {
         
     }
     printf(HRED"\n  Nearest free qubits:"CRESET);
-    if (layout->nearest_free_qubits == NULL) {
-        printf("None\n");
-    } else {
-        for (int i = 0; i < layout->device->num_comm_qubits; i++) {
-            if (i % 8 == 0) {
-                printf("\n  ");
-            }
-            int nearest_id = heap_get_min(layout->nearest_free_qubits[i]).id;
-            core_t core = layout->device->phys_to_core[layout->device->comm_qubits[i]];
-            pqubit_t p_offset = layout->device->core_qubits[core][0];
-            if (nearest_id == -1) {
-                printf(MAG"%*d→"CRESET"%*s ", 4, layout->device->comm_qubits[i], 3, " ");
-            } else {
-                printf(MAG"%*d→"CRESET"%*d ", 4, layout->device->comm_qubits[i], 3, nearest_id + p_offset);
-            }
+    for (int i = 0; i < layout->device->num_comm_qubits; i++) {
+        if (i % 8 == 0) {
+            printf("\n  ");
+        }
+        pqubit_t p_comm = layout->device->comm_qubits[i];
+        pqubit_t p_free = layout_find_nearest_free_qubit(layout, i);
+        if (p_free == -1) {
+            printf(MAG"%*d→"CRESET"%*s ", 4, p_comm, 3, " ");
+        } else {
+            printf(MAG"%*d→"CRESET"%*d ", 4, p_comm, 3, p_free);
         }
     }
 
@@ -288,26 +412,26 @@ void layout_print(const layout_t *layout) {
 }
 
 
-layout_t *initial_layout(device_t *device, circuit_t *circuit, config_t *config) {
+layout_t *initial_layout(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng) {
     layout_t *layout = NULL;
 
     switch (config->initial_layout_type) {
         case INITIAL_LAYOUT_HUNGARIAN:
-            layout = initial_layout_hungarian(device, circuit, config);
+            layout = initial_layout_hungarian(device, circuit, config, rng);
             break;
         case INITIAL_LAYOUT_ROUND_ROBIN:
-            layout = initial_layout_round_robin(device, circuit, config);
+            layout = initial_layout_round_robin(device, circuit, config, rng);
             break;
         default:
-            layout = initial_layout_random(device, circuit, config);
+            layout = initial_layout_random(device, circuit, config, rng);
     }
 
-    layout_init_nearest_free_qubits(layout);
+    layout_init_nearest_free_qubits(layout, !config->enable_fixed_nearest_free_ties);
     return layout;
 }
 
 
-layout_t *initial_layout_hungarian(device_t *device, circuit_t *circuit, config_t *config) {
+layout_t *initial_layout_hungarian(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng) {
     // Initialize layout
     layout_t *layout = layout_new(device, circuit);
 
@@ -365,7 +489,7 @@ layout_t *initial_layout_hungarian(device_t *device, circuit_t *circuit, config_
     // Random permutation of qubits in each core
     pqubit_t *permutation = malloc(sizeof(pqubit_t) * device->num_qubits);
     for (pqubit_t p = 0; p < device->num_qubits; p++) permutation[p] = p;
-    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t));
+    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t), rng);
     // Assign virtual qubits to physical qubits
     vqubit_t virt_empty = circuit->num_qubits;
     for (pqubit_t p = 0; p < device->num_qubits; p++) {
@@ -396,7 +520,7 @@ layout_t *initial_layout_hungarian(device_t *device, circuit_t *circuit, config_
 }
 
 
-layout_t *initial_layout_round_robin(device_t *device, circuit_t *circuit, config_t *config) {
+layout_t *initial_layout_round_robin(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng) {
     // Initialize layout
     layout_t *layout = layout_new(device, circuit);
     // Assign virtual qubits to cores in round-robin fashion
@@ -420,7 +544,7 @@ layout_t *initial_layout_round_robin(device_t *device, circuit_t *circuit, confi
     // Random permutation of qubits in each core
     pqubit_t *permutation = malloc(sizeof(pqubit_t) * device->num_qubits);
     for (pqubit_t p = 0; p < device->num_qubits; p++) permutation[p] = p;
-    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t));
+    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t), rng);
     // Assign virtual qubits to physical qubits
     vqubit_t virt_empty = circuit->num_qubits;
     for (pqubit_t p = 0; p < device->num_qubits; p++) {
@@ -448,13 +572,13 @@ layout_t *initial_layout_round_robin(device_t *device, circuit_t *circuit, confi
 }
 
 
-layout_t *initial_layout_random(device_t *device, circuit_t *circuit, config_t *config) {
+layout_t *initial_layout_random(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng) {
     // Initialize layout
     layout_t *layout = layout_new(device, circuit);
     // Assign virtual qubits to phyisical qubits randomly
     pqubit_t *permutation = malloc(sizeof(pqubit_t) * device->num_qubits);
     for (pqubit_t p = 0; p < device->num_qubits; p++) permutation[p] = p;
-    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t));
+    fisher_yates(permutation, device->num_qubits, sizeof(pqubit_t), rng);
     // Assign virtual qubits to physical qubits
     vqubit_t virt_empty = circuit->num_qubits;
     vqubit_t virt = 0;
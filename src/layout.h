@@ -6,18 +6,27 @@
 #include "config.h"
 #include "device.h"
 #include "heap.h"
+#include "utils.h"
 
 
 typedef struct {
     vqubit_t *phys_to_virt;          // Maps physical qubits to virtual qubits
     pqubit_t *virt_to_phys;          // Maps virtual qubits to physical qubits
     int *core_remaining_capacities;  // Number of free physical positions in each core
-    heap_t **nearest_free_qubits;    // Nearest free qubit min heap for each communication qubit
+    uint64_t *core_free_masks;       // Free positions of each core, core_mask_words words per core
+    heap_t **nearest_free_qubits;    // Nearest free qubit min heap for each comm qubit, NULL if ties are fixed
 
     const device_t *device;    // Pointer to the device this layout is for
     const circuit_t *circuit;  // Pointer to the circuit this layout is for
 } layout_t;
 
+typedef struct {
+    pqubit_t phys1;               // Physical qubits whose virtual qubits were exchanged
+    pqubit_t phys2;
+    core_t core_freed;            // Core that gained a free position (-1 if none)
+    core_t core_filled;           // Core that lost a free position (-1 if none)
+} layout_undo_t;
+
 bool layout_is_phys_free(const layout_t *layout, pqubit_t phys);
 
 pqubit_t layout_get_phys(const layout_t *layout, vqubit_t virt);
@@ -36,20 +45,36 @@ void layout_apply_swap(layout_t *layout, pqubit_t phys1, pqubit_t phys2);
 
 void layout_apply_teleport(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target);
 
-pqubit_t layout_get_nearest_free_qubit(const layout_t *layout, pqubit_t qubit);
+void layout_apply_swap_undoable(layout_t *layout, pqubit_t phys1, pqubit_t phys2, layout_undo_t *undo);
+
+void layout_apply_teleport_undoable(layout_t *layout, pqubit_t phys_source, pqubit_t phys_mediator, pqubit_t phys_target, layout_undo_t *undo);
+
+void layout_undo(layout_t *layout, const layout_undo_t *undo);
+
+layout_undo_t *layout_undo_new();
 
-void layout_init_nearest_free_qubits(layout_t *layout);
+void layout_undo_free(layout_undo_t *undo);
+
+pqubit_t layout_get_nearest_free_qubit(const layout_t *layout, int comm_qubit_id);
+
+int layout_get_nearest_free_distance(const layout_t *layout, int comm_qubit_id);
+
+void layout_init_nearest_free_qubits(layout_t *layout, bool track_heaps);
+
+void layout_free_nearest_free_heaps(layout_t *layout);
 
 layout_t *layout_new(const device_t *device, const circuit_t *circuit);
 
 layout_t *layout_copy(const layout_t *layout);
 
+void layout_copy_into(layout_t *dst, const layout_t *src);
+
 void layout_free(layout_t *layout);
 
 void layout_print(const layout_t *layout);
 
 
-layout_t *initial_layout(device_t *device, circuit_t *circuit, config_t *config);
-layout_t *initial_layout_hungarian(device_t *device, circuit_t *circuit, config_t *config);
-layout_t *initial_layout_round_robin(device_t *device, circuit_t *circuit, config_t *config);
-layout_t *initial_layout_random(device_t *device, circuit_t *circuit, config_t *config);
\ No newline at end of file
+layout_t *initial_layout(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng);
+layout_t *initial_layout_hungarian(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng);
+layout_t *initial_layout_round_robin(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng);
+layout_t *initial_layout_random(const device_t *device, const circuit_t *circuit, const config_t *config, rng_t *rng);
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+log_level_t log_level = LOG_QUIET;
+
+
+void log_set_level(log_level_t level) {
+    log_level = level;
+}
+
+
+log_level_t log_level_from_str(const char *value) {
+    if (strcmp(value, "quiet") == 0) {
+        return LOG_QUIET;
+    } else if (strcmp(value, "summary") == 0) {
+        return LOG_SUMMARY;
+    } else if (strcmp(value, "debug") == 0) {
+        return LOG_DEBUG;
+    } else if (strcmp(value, "trace") == 0) {
+        return LOG_TRACE;
+    } else {
+        fprintf(stderr, "Unknown log level: %s\n", value);
+        exit(1);
+    }
+}
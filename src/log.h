@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+
+
+typedef enum log_level {
+    LOG_QUIET,    // Final result only
+    LOG_SUMMARY,  // Loading, attempts and per run statistics
+    LOG_DEBUG,    // Front, paths, gates and operations of every iteration
+    LOG_TRACE     // Layout and candidate table of every iteration
+} log_level_t;
+
+// Levels above this one are compiled out, e.g. -DTS_LOG_MAX_LEVEL=LOG_SUMMARY
+#ifndef TS_LOG_MAX_LEVEL
+#define TS_LOG_MAX_LEVEL LOG_TRACE
+#endif
+
+// Process-wide, set once before any run starts
+extern log_level_t log_level;
+
+#define log_enabled(level) ((level) <= TS_LOG_MAX_LEVEL && (level) <= log_level)
+
+// Multi-line dumps should check log_enabled once around the whole block
+#define log_printf(level, ...) do { if (log_enabled(level)) printf(__VA_ARGS__); } while (0)
+
+void log_set_level(log_level_t level);
+
+log_level_t log_level_from_str(const char *value);
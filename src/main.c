@@ -3,34 +3,111 @@
 #include <stdbool.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "circuit.h"
 #include "config.h"
 #include "device.h"
+#include "log.h"
 #include "telesabre.h"
+#include "thread_pool.h"
+
+
+typedef struct {
+    const config_t *config;
+    device_t *device;
+    circuit_t *circuit;
+
+    pthread_mutex_t mutex;
+    int next_attempt;
+    int successes;
+    int best_attempt;
+    result_t best;
+    atomic_bool cancel;
+} attempt_driver_t;
+
+
+static void run_attempts_worker(void *arg, int worker_id) {
+    attempt_driver_t *driver = arg;
+    const config_t *config = driver->config;
+
+    while (true) {
+        pthread_mutex_lock(&driver->mutex);
+        bool done = driver->next_attempt >= config->max_attempts || driver->successes >= config->required_successes;
+        int attempt = driver->next_attempt++;
+        pthread_mutex_unlock(&driver->mutex);
+        if (done) break;
+
+        // Only the seed differs between attempts
+        config_t attempt_config = *config;
+        attempt_config.seed = config->seed + attempt;
+
+        result_t result_tmp = telesabre_run_cancellable(&attempt_config, driver->device, driver->circuit, &driver->cancel);
+        if (!result_tmp.success) continue;
+
+        pthread_mutex_lock(&driver->mutex);
+        log_printf(LOG_SUMMARY, "Telesabre run with seed %u successful!\n", attempt_config.seed);
+        int num_comm_ops = result_tmp.num_teledata + result_tmp.num_telegate;
+        int best_num_comm_ops = driver->best.num_teledata + driver->best.num_telegate;
+        // Ties go to the lower seed, as in the sequential loop
+        if (num_comm_ops < best_num_comm_ops || (num_comm_ops == best_num_comm_ops && attempt < driver->best_attempt)) {
+            driver->best = result_tmp;
+            driver->best_attempt = attempt;
+        }
+        driver->successes++;
+        if (driver->successes >= config->required_successes) {
+            atomic_store(&driver->cancel, true);
+        }
+        pthread_mutex_unlock(&driver->mutex);
+    }
+}
+
+
+// Runs seeds config->seed, config->seed + 1, ... on config->jobs threads until
+// enough attempts succeed, then cancels the attempts still running.
+static result_t run_attempts_parallel(const config_t *config, device_t *device, circuit_t *circuit, int *successes_out) {
+    attempt_driver_t driver = {
+        .config = config,
+        .device = device,
+        .circuit = circuit,
+        .next_attempt = 0,
+        .successes = 0,
+        .best_attempt = INT_MAX,
+        .best = {.num_teledata = INT_MAX}
+    };
+    pthread_mutex_init(&driver.mutex, NULL);
+    atomic_init(&driver.cancel, false);
+
+    thread_pool_t *pool = thread_pool_new(config->jobs);
+    thread_pool_run(pool, run_attempts_worker, &driver);
+    thread_pool_free(pool);
+
+    pthread_mutex_destroy(&driver.mutex);
+
+    *successes_out = driver.successes;
+    return driver.best;
+}
+
 
 int main(int argc, char *argv[]) {
     const char *banner = "  _____    _     ___   _   ___ ___ ___ \n"
                          " |_   _|__| |___/ __| /_\\ | _ ) _ \\ __|\n"
                          "   | |/ -_) / -_)__ \\/ _ \\| _ \\   / _| \n"
                          "   |_|\\___|_\\___|___/_/ \\_\\___/_|_\\___|\n";
-    puts(banner);
 
     config_t *config = NULL;
     device_t *device = NULL;
     circuit_t *circuit = NULL;
 
+    // Config and overrides first, so that the log level applies to loading the device and circuit
     for (int i = 1; i < argc; ++i) {
         const char *argument = argv[i];
         const char *ext = strrchr(argument, '.');
         if (ext != NULL && strcmp(ext, ".qasm") == 0) {
-            printf("Parsing .qasm file: %s\n", argument);
-            circuit = circuit_from_qasm(argument);
+            continue;
         } else if (ext != NULL && strcmp(ext, ".json") == 0) {
-            printf("Parsing .json file: %s\n", argument);
-            if (!device) device = device_from_json(argument);
             if (!config) config = config_from_json(argument);
-            if (!circuit) circuit = circuit_from_json(argument);
         } else if (strncmp(argument, "--", 2) == 0) {
             if (!config) {
                 fprintf(stderr, "Error: Provide config before override arguments.\n");
@@ -45,6 +122,24 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (config) log_set_level(config->log_level);
+    if (log_enabled(LOG_SUMMARY)) puts(banner);
+
+    for (int i = 1; i < argc; ++i) {
+        const char *argument = argv[i];
+        const char *ext = strrchr(argument, '.');
+        if (strncmp(argument, "--", 2) == 0) {
+            i++;
+        } else if (strcmp(ext, ".qasm") == 0) {
+            log_printf(LOG_SUMMARY, "Parsing .qasm file: %s\n", argument);
+            circuit = circuit_from_qasm(argument);
+        } else {
+            log_printf(LOG_SUMMARY, "Parsing .json file: %s\n", argument);
+            if (!device) device = device_from_json(argument);
+            if (!circuit) circuit = circuit_from_json(argument);
+        }
+    }
+
     if (!config)
         fprintf(stderr, "Missing config file.\n");
     if (!device)
@@ -61,27 +156,32 @@ int main(int argc, char *argv[]) {
     result_t result = {0};
     result.num_teledata = INT_MAX;
 
-    int max_iterations = config->max_iterations;
-    bool save_report = config->save_report;
     int successes = 0;
-    for (int i = 0; i < config->max_attempts && successes < config->required_successes; i++) {
-        config->max_iterations = max_iterations; 
-        config->save_report = save_report;
-        
-        result_t result_tmp = telesabre_run(config, device, circuit);
-        if (result_tmp.success) {
-            printf("Telesabre run successful!\n");
-            if (result_tmp.num_teledata + result_tmp.num_telegate < result.num_teledata + result.num_telegate) {
-                result = result_tmp;
+    if (config->check_allocations && config->jobs > 1) {
+        fprintf(stderr, "Error: check_allocations counts process-wide, run it with jobs = 1.\n");
+        return 1;
+    }
+
+    if (config->jobs > 1) {
+        result = run_attempts_parallel(config, device, circuit, &successes);
+    } else {
+        for (int i = 0; i < config->max_attempts && successes < config->required_successes; i++) {
+            result_t result_tmp = telesabre_run(config, device, circuit);
+            if (result_tmp.success) {
+                log_printf(LOG_SUMMARY, "Telesabre run successful!\n");
+                if (result_tmp.num_teledata + result_tmp.num_telegate < result.num_teledata + result.num_telegate) {
+                    result = result_tmp;
+                }
+                successes++;
+            } else if (i < config->max_attempts - 1) { 
+                log_printf(LOG_SUMMARY, "Telesabre run failed, retrying with different seed...\n");
             }
-            successes++;
-        } else if (i < config->max_attempts - 1) { 
-            printf("Telesabre run failed, retrying with different seed...\n");
-        }
-        config->seed++;
-    } 
+            config->seed++;
+        } 
+    }
 
-    device_print(device);
+    if (log_enabled(LOG_SUMMARY))
+        device_print(device);
 
     if (result.num_teledata == INT_MAX) {
         printf("No successful runs :(\n");
@@ -96,7 +196,17 @@ int main(int argc, char *argv[]) {
         printf("  Telegate: %d\n", result.num_telegate);
         printf("  Swaps: %d\n", result.num_swaps);
         printf("  Deadlocks: %d\n", result.num_deadlocks);
+        if (config->top_k_candidates > 0 && config->audit_top_k_candidates)
+            printf("  Top-k changed choice: %d/%d\n", result.stats.num_top_k_changed, result.stats.num_top_k_cuts);
         printf("  Success: %s\n", result.success ? "true" : "false");
+        if (config->jobs > 1 && config->save_report) {
+            char report_filename[sizeof(config->report_filename) + 16];
+            telesabre_attempt_filename(config, config->report_filename, result.seed, report_filename, sizeof(report_filename));
+            printf("  Report: %s\n", report_filename);
+        }
+        char *stats_json = run_stats_to_json(&result.stats);
+        printf("  Stats: %s\n", stats_json);
+        free(stats_json);
     }
 
     device_free(device);
@@ -19,6 +19,14 @@ typedef enum op_target {
     OP_TARGET_B    = 3,
 } op_target_t;
 
+// Why a teleport or telegate was proposed, swaps use bits 0-5 for busy, in front and nearest free
+// of their two qubits. Duplicate candidates are merged and their reasons combined.
+#define OP_REASON_FORWARD        (1 << 0)
+#define OP_REASON_REVERSE        (1 << 1)
+#define OP_REASON_TELEGATE       (1 << 2)
+#define OP_REASON_CORE_EMPTYING  (1 << 3)
+#define OP_REASON_SHARED         (1 << 7)  // Proposed for more than one front gate
+
 typedef struct op {
     op_type_t type;
     pqubit_t qubits[4];
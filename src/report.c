@@ -93,6 +93,11 @@ void report_save_as_json(
         }
         cJSON_AddItemToObject(entry_json, "candidate_ops", candidate_ops);
 
+        cJSON *candidate_ops_reasons = cJSON_CreateArray();
+        for (size_t j = 0; j < entry->num_candidate_ops; j++)
+            cJSON_AddItemToArray(candidate_ops_reasons, cJSON_CreateNumber(entry->candidate_ops[j].reasons));
+        cJSON_AddItemToObject(entry_json, "candidate_ops_reasons", candidate_ops_reasons);
+
         cJSON *candidate_ops_energies = cJSON_CreateFloatArray(entry->candidate_ops_energies, entry->num_candidate_ops);
         cJSON_AddItemToObject(entry_json, "candidate_ops_scores", candidate_ops_energies);
         cJSON *candidate_ops_front_energies = cJSON_CreateFloatArray(entry->candidate_ops_front_energies, entry->num_candidate_ops);
@@ -110,7 +115,10 @@ void report_save_as_json(
     cJSON_AddItemToObject(json, "iterations", iters_json);
 
     if (config && config->json) {
-        cJSON_AddItemToObject(json, "config", cJSON_Duplicate(config->json, 1));
+        // The seed of the attempt, parallel attempts share the config file
+        cJSON *config_json = cJSON_Duplicate(config->json, 1);
+        cJSON_ReplaceItemInObject(config_json, "seed", cJSON_CreateNumber(config->seed));
+        cJSON_AddItemToObject(json, "config", config_json);
     }
     if (device && device->json) {
         cJSON_AddItemToObject(json, "device", cJSON_Duplicate(device->json, 1));
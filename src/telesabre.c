@@ -5,22 +5,125 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #include "circuit.h"
 #include "config.h"
 #include "device.h"
 #include "layout.h"
+#include "log.h"
 #include "report.h"
 #include "utils.h"
 #include "graph.h"
+#include "thread_pool.h"
+#include "alloc_count.h"
 
 
-telesabre_t* telesabre_init(config_t* config, device_t* device, circuit_t* circuit) {
+static void telesabre_add_front_gate(telesabre_t* ts, size_t gate_id);
+static int telesabre_comm_node_weight(const telesabre_t* ts, const layout_t* layout, int comm_node);
+
+
+// Swaps use distinct device edges, every attraction path adds at most a telegate, 
+// two teleports and the core emptying teleports around both teleport targets.
+static int telesabre_max_candidate_ops(const telesabre_t* ts) {
+    int max_degree = 0;
+    for (pqubit_t p = 0; p < ts->device->num_qubits; p++)
+        if (device_get_degree(ts->device, p) > max_degree) max_degree = device_get_degree(ts->device, p);
+
+    int max_tele_ops_per_path = 3 + 2 * max_degree;
+    return ts->device->num_edges + (int)ts->max_front_paths * max_tele_ops_per_path;
+}
+
+
+static size_t telesabre_candidate_op_hash(const op_t* op) {
+    uint64_t h = hash_u64(op->type);
+    for (int i = 0; i < op_get_num_qubits(op); i++)
+        h = hash_u64(h ^ (uint64_t)op->qubits[i]);
+    return (size_t)h;
+}
+
+
+static bool telesabre_candidate_ops_equal(const op_t* a, const op_t* b) {
+    if (a->type != b->type) return false;
+    for (int i = 0; i < op_get_num_qubits(a); i++)
+        if (a->qubits[i] != b->qubits[i]) return false;
+    return true;
+}
+
+
+// Keeps the set at most half full, reinserting the current candidates
+static void telesabre_resize_candidate_op_slots(telesabre_t* ts) {
+    size_t num_slots = 16;
+    while (num_slots < 2 * (size_t)ts->candidate_ops_capacity) num_slots *= 2;
+    free(ts->candidate_op_slots);
+    ts->candidate_op_slots = malloc(sizeof(int) * num_slots);
+    check_alloc(1, ts->candidate_op_slots);
+    ts->candidate_op_slots_mask = num_slots - 1;
+    memset(ts->candidate_op_slots, -1, sizeof(int) * num_slots);
+
+    for (int i = 0; i < ts->num_candidate_ops; i++) {
+        size_t slot = telesabre_candidate_op_hash(&ts->candidate_ops[i]) & ts->candidate_op_slots_mask;
+        while (ts->candidate_op_slots[slot] >= 0) slot = (slot + 1) & ts->candidate_op_slots_mask;
+        ts->candidate_op_slots[slot] = i;
+    }
+}
+
+
+// Cheapest way from each qubit to a comm qubit of its core, and inter-core edges needed between 
+// each pair of cores. A separated gate costs at least both exits plus the edges between its cores.
+static void telesabre_init_energy_bounds(telesabre_t* ts) {
+    const device_t* device = ts->device;
+    int num_cores = device->num_cores;
+
+    ts->comm_exit_costs = malloc(sizeof(int) * device->num_qubits);
+    ts->core_hops = malloc(sizeof(int) * num_cores * num_cores);
+    core_t* queue = malloc(sizeof(core_t) * num_cores);
+    check_alloc(3, ts->comm_exit_costs, ts->core_hops, queue);
+
+    for (pqubit_t p = 0; p < device->num_qubits; p++) {
+        core_t core = device->phys_to_core[p];
+        int cost = TS_INF;
+        for (int j = 0; j < device->core_num_comm_qubits[core]; j++) {
+            int distance = abs(device_get_distance(device, p, device->core_comm_qubits[core][j]) - 1);
+            if (distance < cost) cost = distance;
+        }
+        ts->comm_exit_costs[p] = cost;
+    }
+
+    // BFS over inter-core edges from every core, the core graph is tiny
+    for (int i = 0; i < num_cores * num_cores; i++) ts->core_hops[i] = TS_INF;
+    for (core_t src = 0; src < num_cores; src++) {
+        int* hops = &ts->core_hops[src * num_cores];
+        int head = 0, tail = 0;
+        hops[src] = 0;
+        queue[tail++] = src;
+        while (head < tail) {
+            core_t c = queue[head++];
+            for (int e = 0; e < device->num_intercore_edges; e++) {
+                core_t c1 = device->phys_to_core[device->inter_core_edges[e].p1];
+                core_t c2 = device->phys_to_core[device->inter_core_edges[e].p2];
+                core_t next = c1 == c ? c2 : (c2 == c ? c1 : -1);
+                if (next == -1 || hops[next] != TS_INF) continue;
+                hops[next] = hops[c] + 1;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    free(queue);
+}
+
+
+telesabre_t* telesabre_init(const config_t* config, const device_t* device, const circuit_t* circuit) {
     telesabre_t* ts = malloc(sizeof(telesabre_t));
 
     ts->config = config;
     ts->device = device;
     ts->circuit = circuit;
+
+    rng_seed(&ts->rng, config->seed);
+    ts->max_iterations = config->max_iterations;
+    ts->save_report = config->save_report;
     
     // Inizialize circuit front
     ts->gate_num_remaining_parents = malloc(sizeof(size_t) * circuit->num_gates);
@@ -29,15 +132,24 @@ telesabre_t* telesabre_init(config_t* config, device_t* device, circuit_t* circu
 
     ts->front = malloc(sizeof(size_t) * circuit->num_gates);
     ts->front_size = 0;
+    ts->gate_front_pos = malloc(sizeof(size_t) * circuit->num_gates);
+    ts->vqubit_front_gate = malloc(sizeof(size_t) * device->num_qubits);
+    ts->ready_gates = malloc(sizeof(size_t) * circuit->num_gates);
+    ts->num_ready_gates = 0;
+    ts->gate_ready_pos = malloc(sizeof(size_t) * circuit->num_gates);
+    check_alloc(5, ts->front, ts->gate_front_pos, ts->vqubit_front_gate, ts->ready_gates, ts->gate_ready_pos);
+    for (size_t g = 0; g < circuit->num_gates; g++) ts->gate_ready_pos[g] = (size_t)-1;
+    for (pqubit_t q = 0; q < device->num_qubits; q++) ts->vqubit_front_gate[q] = (size_t)-1;
+
+    // Inizialize layout
+    ts->layout = initial_layout(device, circuit, config, &ts->rng);
+
     for (size_t g = 0; g < circuit->num_gates; g++) {
         if (ts->gate_num_remaining_parents[g] == 0) {
-            ts->front[ts->front_size++] = g;
+            telesabre_add_front_gate(ts, g);
         }
     }
 
-    // Inizialize layout
-    ts->layout = initial_layout(device, circuit, config);
-
     // Usage Penalties
     ts->usage_penalties = malloc(sizeof(float) * device->num_qubits);
     for (pqubit_t p = 0; p < device->num_qubits; p++) 
@@ -50,37 +162,98 @@ telesabre_t* telesabre_init(config_t* config, device_t* device, circuit_t* circu
 
     ts->safety_valve_activated = false;
     ts->last_progress_layout = layout_copy(ts->layout);
+    ts->stats = (run_stats_t){0};
+    ts->trace = NULL;
+
+    // Per-iteration buffers are sized from device and circuit limits, so steps do not allocate.
+    // Front gates act on disjoint qubits and a pair path visits each contracted graph node once.
+    ts->max_front_paths = circuit->num_qubits;
+    ts->max_path_length = device->num_comm_qubits + 2;
+    ts->max_traffic = (circuit->num_qubits + config->extended_set_size + 1) * (device->num_comm_qubits + 1);
+
+    // Energy lower bounds for pruning candidate evaluations
+    telesabre_init_energy_bounds(ts);
+
+    // All-pairs tables of the comm qubit graph, recomputed when the comm node weights change
+    ts->apsp.node_weights = malloc(sizeof(int) * device->num_comm_qubits);
+    ts->apsp.dist = malloc(sizeof(int) * device->num_comm_qubits * device->num_comm_qubits);
+    ts->apsp.next = malloc(sizeof(int) * device->num_comm_qubits * device->num_comm_qubits);
+    ts->apsp.valid = false;
+    ts->apsp.epoch = 0;
+    ts->apsp.weights_key = 0;
+
+    // Energy evaluators, pool workers get their own layout copies
+    ts->eval = telesabre_new_eval_scratch(ts, false);
+    ts->pool = NULL;
+    ts->eval_workers = NULL;
+    if (config->num_threads > 1) {
+        ts->pool = thread_pool_new(config->num_threads);
+        ts->eval_workers = malloc(sizeof(eval_scratch_t*) * config->num_threads);
+        for (int i = 0; i < config->num_threads; i++)
+            ts->eval_workers[i] = telesabre_new_eval_scratch(ts, true);
+    }
 
     // Array of candidate operations
-    ts->candidate_ops = NULL;
-    ts->candidate_ops_energies = NULL;
+    ts->candidate_ops_capacity = telesabre_max_candidate_ops(ts);
+    ts->candidate_ops = malloc(sizeof(op_t) * ts->candidate_ops_capacity);
+    ts->candidate_ops_energies = malloc(sizeof(float) * ts->candidate_ops_capacity);
+    ts->candidate_ops_front_energies = malloc(sizeof(float) * ts->candidate_ops_capacity);
+    ts->best_operations = malloc(sizeof(op_t) * ts->candidate_ops_capacity);
+    ts->top_k_ops = malloc(sizeof(int) * ts->candidate_ops_capacity);
     ts->num_candidate_ops = 0;
-    ts->candidate_ops_capacity = 0;
+    ts->candidate_op_slots = NULL;
+    telesabre_resize_candidate_op_slots(ts);
+    ts->num_merged_candidate_ops = 0;
+    ts->top_k_screened = false;
+
+    // At most one slice of disjoint gates in front plus the extended set
+    ts->base_energy_terms = malloc(sizeof(energy_term_t) * (circuit->num_qubits + config->extended_set_size + 1));
+    ts->num_base_energy_terms = 0;
+    ts->base_traffic = malloc(sizeof(int[3]) * ts->max_traffic);
+    ts->base_traffic_capacity = ts->max_traffic;
+    ts->base_nearest_free_distances = malloc(sizeof(int) * device->num_comm_qubits);
+    ts->base_energy_valid = false;
 
     // Remaining slices
     ts->remaining_slices = malloc(sizeof(size_t) * circuit->num_gates);
     ts->remaining_slices_ptr = malloc(sizeof(size_t) * (circuit->num_gates + 1));
     ts->num_remaining_slices = 0;
+    ts->slices_outdated = true;
+    ts->slice_rem_parents = malloc(sizeof(size_t) * circuit->num_gates);
+    ts->slice_stamps = calloc(circuit->num_gates, sizeof(unsigned));
+    ts->slice_epoch = 0;
+    ts->slice_queue = malloc(sizeof(size_t) * circuit->num_gates);
+    ts->num_remaining_gates = circuit->num_gates;
 
     // Applied gates
     ts->applied_gates = malloc(sizeof(int) * circuit->num_gates);
     ts->num_applied_gates = 0;
 
-    // Attraction paths
-    ts->attraction_paths = NULL;
-    ts->attraction_paths_front_idx = NULL;
+    // Attraction paths, filled in place every iteration
+    ts->attraction_paths_capacity = ts->max_front_paths;
+    ts->attraction_paths = malloc(sizeof(path_t*) * ts->attraction_paths_capacity);
+    ts->attraction_paths_front_idx = malloc(sizeof(int) * ts->attraction_paths_capacity);
+    for (size_t i = 0; i < ts->attraction_paths_capacity; i++)
+        ts->attraction_paths[i] = path_new(ts->max_path_length);
     ts->num_attraction_paths = 0;
-    ts->attraction_paths_capacity = 0;
+    ts->attraction_path_cache = malloc(sizeof(attraction_path_cache_t) * circuit->num_qubits);
+    check_alloc(1, ts->attraction_path_cache);
+    for (size_t v = 0; v < circuit->num_qubits; v++) {
+        ts->attraction_path_cache[v].gate_id = (size_t)-1;
+        ts->attraction_path_cache[v].path = path_new(ts->max_path_length);
+    }
+    ts->num_attraction_path_reuses = 0;
+    ts->num_attraction_path_lookups = 0;
 
     // Traversed communication qubits
-    ts->traversed_comm_qubits = NULL;
+    ts->traversed_comm_qubits_capacity = ts->max_front_paths * ts->max_path_length;
+    ts->traversed_comm_qubits = malloc(sizeof(pqubit_t) * ts->traversed_comm_qubits_capacity);
     ts->num_traversed_comm_qubits = 0;
-    ts->traversed_comm_qubits_capacity = 0;
 
     // Nearest free qubits
-    ts->nearest_free_qubits = NULL;
+    ts->nearest_free_qubits_capacity = ts->traversed_comm_qubits_capacity;
+    ts->nearest_free_qubits = malloc(sizeof(pqubit_t) * ts->nearest_free_qubits_capacity);
     ts->num_nearest_free_qubits = 0;
-    ts->nearest_free_qubits_capacity = 0;
 
     ts->result = (result_t){
         .depth = 0,
@@ -93,25 +266,72 @@ telesabre_t* telesabre_init(config_t* config, device_t* device, circuit_t* circu
 
     ts->energy = 0.0f;
     ts->report = report_new();
+    ts->cancel = NULL;
 
     return ts;
 }
 
 
+static void telesabre_remove_ready_gate(telesabre_t* ts, size_t gate_id) {
+    size_t pos = ts->gate_ready_pos[gate_id];
+    if (pos == (size_t)-1) return;
+    size_t last = ts->ready_gates[--ts->num_ready_gates];
+    ts->ready_gates[pos] = last;
+    ts->gate_ready_pos[last] = pos;
+    ts->gate_ready_pos[gate_id] = (size_t)-1;
+}
+
+
+static void telesabre_update_ready_gate(telesabre_t* ts, size_t gate_id) {
+    bool ready = layout_can_execute_gate(ts->layout, &ts->circuit->gates[gate_id]);
+    if (ready && ts->gate_ready_pos[gate_id] == (size_t)-1) {
+        ts->gate_ready_pos[gate_id] = ts->num_ready_gates;
+        ts->ready_gates[ts->num_ready_gates++] = gate_id;
+    } else if (!ready) {
+        telesabre_remove_ready_gate(ts, gate_id);
+    }
+}
+
+
+static void telesabre_add_front_gate(telesabre_t* ts, size_t gate_id) {
+    const gate_t* gate = &ts->circuit->gates[gate_id];
+    ts->gate_front_pos[gate_id] = ts->front_size;
+    ts->front[ts->front_size++] = gate_id;
+    for (int j = 0; j < gate->num_target_qubits; j++)
+        ts->vqubit_front_gate[gate->target_qubits[j]] = gate_id;
+    telesabre_update_ready_gate(ts, gate_id);
+}
+
+
+// Only front gates on the virtual qubits now at the given positions can change executability
+void telesabre_update_ready_gates(telesabre_t* ts, const pqubit_t* phys, int num_phys) {
+    for (int i = 0; i < num_phys; i++) {
+        vqubit_t virt = ts->layout->phys_to_virt[phys[i]];
+        if (virt < 0 || virt >= ts->circuit->num_qubits) continue;
+        size_t gate_id = ts->vqubit_front_gate[virt];
+        if (gate_id != (size_t)-1) telesabre_update_ready_gate(ts, gate_id);
+    }
+}
+
+
 void telesabre_safety_valve_check(telesabre_t *ts) {
     if (ts->it_without_progress > ts->config->safety_valve_iters && !ts->safety_valve_activated) {
         ts->safety_valve_activated = true;
-        layout_free(ts->layout);
-        ts->layout = layout_copy(ts->last_progress_layout);
+        layout_copy_into(ts->layout, ts->last_progress_layout);
+        ts->stats.num_layout_copies++;
+        for (size_t i = 0; i < ts->front_size; i++)
+            telesabre_update_ready_gate(ts, ts->front[i]);
         ts->result = ts->last_progress_result;
-        printf("Safety valve activated at iteration %d\n", ts->it);
+        log_printf(LOG_DEBUG, "Safety valve activated at iteration %d\n", ts->it);
         ts->result.num_deadlocks++;
+        if (ts->trace) trace_instant(ts->trace, "safety_valve_on", monotonic_seconds(), "\"iteration\": %d", ts->it);
     }
 
-    if (ts->safety_valve_activated && ts->it_without_progress > ts->config->safety_valve_iters + ts->config->max_safety_valve_iters && !ts->config->save_report) {
-        printf("Safety valve still activated after %d iterations, exiting...\n", ts->it_without_progress);
-        ts->config->save_report = true;
-        ts->config->max_iterations = ts->it + ts->config->max_safety_valve_iters;
+    if (ts->safety_valve_activated && ts->it_without_progress > ts->config->safety_valve_iters + ts->config->max_safety_valve_iters && !ts->save_report) {
+        log_printf(LOG_SUMMARY, "Safety valve still activated after %d iterations, exiting...\n", ts->it_without_progress);
+        if (ts->trace) trace_instant(ts->trace, "deadlock", monotonic_seconds(), "\"iteration\": %d", ts->it);
+        ts->save_report = true;
+        ts->max_iterations = ts->it + ts->config->max_safety_valve_iters;
     }
 }
 
@@ -120,12 +340,14 @@ void telesabre_execute_front_gate(telesabre_t* ts, size_t front_gate_idx) {
     const gate_t* gate = &ts->circuit->gates[ts->front[front_gate_idx]];
 
     // Debug Print
-    printf(H3COL"  Executing gate "CRESET"%03zu = %s(", ts->front[front_gate_idx], gate->type);
-    for (int j = 0; j < gate->num_target_qubits; j++) {
-        printf("%d", gate->target_qubits[j]);
-        if (j < gate->num_target_qubits - 1) printf(", ");
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H3COL"  Executing gate "CRESET"%03zu = %s(", ts->front[front_gate_idx], gate->type);
+        for (int j = 0; j < gate->num_target_qubits; j++) {
+            printf("%d", gate->target_qubits[j]);
+            if (j < gate->num_target_qubits - 1) printf(", ");
+        }
+        printf(")\n");
     }
-    printf(")\n");
     
     // Update Usage Penalties
     for (vqubit_t v = 0; v < gate->num_target_qubits; v++) {
@@ -135,10 +357,15 @@ void telesabre_execute_front_gate(telesabre_t* ts, size_t front_gate_idx) {
 
     // Mark as executed
     ts->gate_num_remaining_parents[gate->id] = (size_t)-1;
+    ts->num_remaining_gates--;
 
     // Remove from front
+    telesabre_remove_ready_gate(ts, gate->id);
+    for (int j = 0; j < gate->num_target_qubits; j++)
+        ts->vqubit_front_gate[gate->target_qubits[j]] = (size_t)-1;
     if (front_gate_idx < ts->front_size - 1) {
         ts->front[front_gate_idx] = ts->front[ts->front_size - 1];
+        ts->gate_front_pos[ts->front[front_gate_idx]] = front_gate_idx;
     }
     ts->front_size--;
 
@@ -148,10 +375,10 @@ void telesabre_execute_front_gate(telesabre_t* ts, size_t front_gate_idx) {
         ts->gate_num_remaining_parents[child_id]--;
         if (ts->gate_num_remaining_parents[child_id] == 0) {
             if (child_id == 0) {
-                printf("adding node 0 again wtf\n");
+                log_printf(LOG_DEBUG, "Gate %zu lists the first gate as a child, the dependency graph is corrupt\n", gate->id);
                 exit(1);
             }
-            ts->front[ts->front_size++] = child_id;
+            telesabre_add_front_gate(ts, child_id);
         }
     }
 
@@ -165,9 +392,10 @@ void telesabre_made_progress(telesabre_t* ts) {
     if (ts->safety_valve_activated) {
         ts->safety_valve_activated = false;
         ts->result.num_deadlocks++;
+        if (ts->trace) trace_instant(ts->trace, "safety_valve_off", monotonic_seconds(), "\"iteration\": %d", ts->it);
     }
-    layout_free(ts->last_progress_layout);
-    ts->last_progress_layout = layout_copy(ts->layout);
+    layout_copy_into(ts->last_progress_layout, ts->layout);
+    ts->stats.num_layout_copies++;
     ts->last_progress_result = ts->result;
 }
 
@@ -175,25 +403,30 @@ void telesabre_made_progress(telesabre_t* ts) {
 void telesabre_calculate_attraction_paths(telesabre_t *ts) {
     ts->num_attraction_paths = 0;
 
-    if (ts->front_size > ts->attraction_paths_capacity) {
-        ts->attraction_paths_capacity = ts->front_size;
-        ts->attraction_paths = realloc(ts->attraction_paths, sizeof(path_t*) * ts->attraction_paths_capacity);
-        ts->attraction_paths_front_idx = realloc(ts->attraction_paths_front_idx, sizeof(int) * ts->attraction_paths_capacity);
-    }
+    // Node weights depend only on the layout, pair queries without traffic become table lookups
+    telesabre_update_comm_apsp(ts);
+    ts->eval->use_apsp = true;
 
     for (int i = 0; i < ts->front_size; i++) {
         const gate_t* gate = &ts->circuit->gates[ts->front[i]];
         if (!layout_gate_is_separated(ts->layout, gate)) continue;
-        
-        size_t separated_node_ids[2] = {0};
-        pqubit_t node_id_to_phys[2] = {0};
 
-        graph_t* contracted_graph = telesabre_build_contracted_graph_for_pair(ts, ts->layout, gate, separated_node_ids, node_id_to_phys, NULL, 0);
-        
-        int src = separated_node_ids[0];
-        int dst = separated_node_ids[1];
+        path_t* shortest_path = ts->attraction_paths[ts->num_attraction_paths];
+        ts->attraction_paths_front_idx[ts->num_attraction_paths] = i;
+        ts->num_attraction_paths++;
 
-        path_t* shortest_path = graph_dijkstra(contracted_graph, src, dst);
+        attraction_path_cache_t* cached = &ts->attraction_path_cache[gate->target_qubits[0]];
+        pqubit_t p1 = layout_get_phys(ts->layout, gate->target_qubits[0]);
+        pqubit_t p2 = layout_get_phys(ts->layout, gate->target_qubits[1]);
+        ts->num_attraction_path_lookups++;
+        if (cached->gate_id == ts->front[i] && cached->p1 == p1 && cached->p2 == p2 && cached->apsp_epoch == ts->apsp.epoch) {
+            path_copy_into(shortest_path, cached->path);
+            ts->num_attraction_path_reuses++;
+            continue;
+        }
+        
+        pqubit_t node_id_to_phys[2] = {0};
+        telesabre_find_pair_path(ts, ts->eval, gate, NULL, 0, node_id_to_phys, shortest_path);
 
         // Translate internal graph ids to physical qubit id
         for (int j = 0; j < shortest_path->length; j++) {
@@ -205,14 +438,13 @@ void telesabre_calculate_attraction_paths(telesabre_t *ts) {
                 shortest_path->nodes[j] = node_id_to_phys[internal_id];
             }
         }
-        ts->attraction_paths_front_idx[ts->num_attraction_paths] = i;
-        ts->attraction_paths[ts->num_attraction_paths] = shortest_path;
-        ts->num_attraction_paths++;
 
-        graph_free(contracted_graph);
+        *cached = (attraction_path_cache_t){.gate_id = ts->front[i], .p1 = p1, .p2 = p2, .apsp_epoch = ts->apsp.epoch, .path = cached->path};
+        path_copy_into(cached->path, shortest_path);
     }
 
     // Print needed comm. qubits
+    if (!log_enabled(LOG_DEBUG)) return;
     printf(H2COL"  Needed Paths: "CRESET"%zu\n", ts->num_attraction_paths);
     for (int i = 0; i < ts->num_attraction_paths; i++) {
         printf("    Path %d: ", i);
@@ -249,10 +481,12 @@ void telesabre_collect_traversed_comm_qubits(telesabre_t *ts) {
         }
     }
 
-    printf(H2COL"  Needed communication qubits: "CRESET);
-    for (int j = 0; j < ts->num_traversed_comm_qubits; j++)
-        printf("%d ", ts->traversed_comm_qubits[j]);
-    printf("\n");
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H2COL"  Needed communication qubits: "CRESET);
+        for (int j = 0; j < ts->num_traversed_comm_qubits; j++)
+            printf("%d ", ts->traversed_comm_qubits[j]);
+        printf("\n");
+    }
 }
 
 
@@ -274,54 +508,80 @@ void telesabre_collect_nearest_free_qubits(telesabre_t *ts) {
             
     }
 
-    printf(H2COL"  Needed nearest free qubits: "CRESET);
-    for (int j = 0; j < ts->num_nearest_free_qubits; j++)
-        printf("%d ", ts->nearest_free_qubits[j]);
-    printf("\n");
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H2COL"  Needed nearest free qubits: "CRESET);
+        for (int j = 0; j < ts->num_nearest_free_qubits; j++)
+            printf("%d ", ts->nearest_free_qubits[j]);
+        printf("\n");
+    }
 }
 
 
+// Remaining parents of a gate during slicing. Entries are copied from the run 
+// state on first use, so slicing only touches the gates up to the horizon.
+static size_t* telesabre_slice_rem_parents(telesabre_t *ts, size_t g) {
+    if (ts->slice_stamps[g] != ts->slice_epoch) {
+        ts->slice_stamps[g] = ts->slice_epoch;
+        ts->slice_rem_parents[g] = ts->gate_num_remaining_parents[g];
+    }
+    return &ts->slice_rem_parents[g];
+}
+
+
+static int compare_gate_ids(const void *a, const void *b) {
+    size_t ga = *(const size_t *)a, gb = *(const size_t *)b;
+    return (ga > gb) - (ga < gb);
+}
+
+
+// Levels the remaining circuit from the front, up to the slices the energy needs: 
+// the front slice plus enough slices for extended_set_size two-qubit gates.
 void telesabre_slice_remaining_circuit(telesabre_t *ts) {
     size_t num_gates = ts->circuit->num_gates;
-    size_t *rem_parents = malloc(sizeof(size_t) * num_gates);
-    memcpy(rem_parents, ts->gate_num_remaining_parents, sizeof(size_t) * num_gates);
+
+    if (++ts->slice_epoch == 0) {
+        memset(ts->slice_stamps, 0, sizeof(unsigned) * num_gates);
+        ts->slice_epoch = 1;
+    }
 
     // Queue for ready gates
-    size_t *queue = malloc(sizeof(size_t) * num_gates);
+    size_t *queue = ts->slice_queue;
     size_t q_head = 0, q_tail = 0;
 
-    // Initialize queue with all gates with in-degree 0
-    for (size_t i = 0; i < num_gates; ++i) {
-        if (rem_parents[i] == 0) {
-            queue[q_tail++] = i;
-        }
-    }
+    // Initialize queue with all gates with in-degree 0, that is the front, in gate order
+    memcpy(queue, ts->front, sizeof(size_t) * ts->front_size);
+    q_tail = ts->front_size;
+    qsort(queue, q_tail, sizeof(size_t), compare_gate_ids);
 
     size_t num_slices = 0;
     size_t gate_out_idx = 0;
+    int num_extended_gates = 0;
 
     while (q_head < q_tail) {
+        if (num_slices >= TS_MIN_SLICES && num_extended_gates >= ts->config->extended_set_size) break;
+
         // Mark the start of this slice
         ts->remaining_slices_ptr[num_slices] = gate_out_idx;
         size_t old_q_tail = q_tail;
 
         for (; q_head < old_q_tail; ++q_head) {
             size_t g = queue[q_head];
-            if (rem_parents[g] == (size_t)-1) continue;
+            if (*telesabre_slice_rem_parents(ts, g) == (size_t)-1) continue;
             size_t curr = g;
 
             // Bypass single-qubit gates
             while (
                 curr < num_gates &&
                 ts->circuit->gates[curr].num_target_qubits == 1 &&
-                rem_parents[curr] != (size_t)-1
+                *telesabre_slice_rem_parents(ts, curr) != (size_t)-1
             ) {
-                rem_parents[curr] = (size_t)-1;
+                *telesabre_slice_rem_parents(ts, curr) = (size_t)-1;
                 if (ts->circuit->gates[curr].num_children == 1) {
                     size_t child = ts->circuit->gates[curr].children_id[0];
-                    if (rem_parents[child] > 0 && rem_parents[child] != (size_t)-1) {
-                        rem_parents[child]--;
-                        if (rem_parents[child] == 0) {
+                    size_t* child_rem_parents = telesabre_slice_rem_parents(ts, child);
+                    if (*child_rem_parents > 0 && *child_rem_parents != (size_t)-1) {
+                        (*child_rem_parents)--;
+                        if (*child_rem_parents == 0) {
                             queue[q_tail++] = child;
                         }
                     }
@@ -331,16 +591,18 @@ void telesabre_slice_remaining_circuit(telesabre_t *ts) {
                     break;
                 }
             }
-            if (curr >= num_gates || rem_parents[curr] == (size_t)-1) continue;
+            if (curr >= num_gates || *telesabre_slice_rem_parents(ts, curr) == (size_t)-1) continue;
 
             // Add two-qubit (or multi-qubit) gate to the slice
-            rem_parents[curr] = (size_t)-1;
+            *telesabre_slice_rem_parents(ts, curr) = (size_t)-1;
             ts->remaining_slices[gate_out_idx++] = curr;
+            if (num_slices > 0 && gate_is_two_qubit(&ts->circuit->gates[curr])) num_extended_gates++;
             for (size_t j = 0; j < ts->circuit->gates[curr].num_children; ++j) {
                 size_t child = ts->circuit->gates[curr].children_id[j];
-                if (rem_parents[child] > 0 && rem_parents[child] != (size_t)-1) {
-                    rem_parents[child]--;
-                    if (rem_parents[child] == 0) {
+                size_t* child_rem_parents = telesabre_slice_rem_parents(ts, child);
+                if (*child_rem_parents > 0 && *child_rem_parents != (size_t)-1) {
+                    (*child_rem_parents)--;
+                    if (*child_rem_parents == 0) {
                         queue[q_tail++] = child;
                     }
                 }
@@ -354,40 +616,322 @@ void telesabre_slice_remaining_circuit(telesabre_t *ts) {
     ts->remaining_slices_ptr[num_slices] = gate_out_idx; // end pointer
 
     ts->num_remaining_slices = num_slices;
+    ts->slices_outdated = false;
+}
 
-    free(rem_parents);
-    free(queue);
+
+static void telesabre_reserve_eval_traffic(eval_scratch_t* scratch, size_t size) {
+    if (size <= scratch->traffic_capacity) return;
+    scratch->traffic_capacity = scratch->traffic_capacity ? scratch->traffic_capacity : 16;
+    while (scratch->traffic_capacity < size) scratch->traffic_capacity *= 2;
+    scratch->traffic = realloc(scratch->traffic, sizeof(int[3]) * scratch->traffic_capacity);
+    check_alloc(1, scratch->traffic);
 }
 
 
-float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op) {
-    // Copy layout and apply op
-    layout_t* layout = layout_copy(ts->layout);
-    if (op->type == OP_TELEPORT) {
-        layout_apply_teleport(layout, op->qubits[0], op->qubits[1], op->qubits[2]);
-    } else if (op->type == OP_SWAP) {
-        layout_apply_swap(layout, op->qubits[0], op->qubits[1]);
+eval_scratch_t* telesabre_new_eval_scratch(const telesabre_t* ts, bool own_layout) {
+    eval_scratch_t* scratch = malloc(sizeof(eval_scratch_t));
+    check_alloc(1, scratch);
+
+    scratch->layout = own_layout ? layout_copy(ts->layout) : ts->layout;
+    // Evaluations only read nearest free distances, their own layouts do not track the heaps
+    if (own_layout) layout_free_nearest_free_heaps(scratch->layout);
+    scratch->owns_layout = own_layout;
+    scratch->undo = layout_undo_new();
+    scratch->contracted_graph = telesabre_new_contracted_graph(ts);
+    scratch->use_apsp = false;
+    scratch->traffic = malloc(sizeof(int[3]) * ts->max_traffic);
+    scratch->traffic_capacity = ts->max_traffic;
+    check_alloc(1, scratch->traffic);
+    scratch->dijkstra = dijkstra_scratch_new(scratch->contracted_graph->graph->num_nodes);
+    scratch->path = path_new(ts->max_path_length);
+    scratch->num_evaluations = 0;
+    scratch->num_pruned = 0;
+    scratch->num_dijkstra_calls = 0;
+    scratch->num_apsp_lookups = 0;
+    scratch->num_layout_copies = 0;
+
+    scratch->cache = NULL;
+    if (ts->config->enable_energy_cache) {
+        scratch->cache = malloc(sizeof(energy_cache_t));
+        check_alloc(1, scratch->cache);
+        scratch->cache->entries = calloc(TS_ENERGY_CACHE_ENTRIES, sizeof(energy_cache_entry_t));
+        scratch->cache->path_capacity = ts->max_path_length;
+        scratch->cache->paths = malloc(sizeof(node_t) * TS_ENERGY_CACHE_ENTRIES * ts->max_path_length);
+        scratch->cache->num_nodes = ts->device->num_comm_qubits;
+        scratch->cache->node_weights = malloc(sizeof(int) * TS_ENERGY_CACHE_ENTRIES * ts->device->num_comm_qubits);
+        scratch->cache->traffic = malloc(sizeof(uint32_t) * TS_ENERGY_CACHE_ENTRIES * TS_ENERGY_CACHE_MAX_TRAFFIC);
+        scratch->node_weights = malloc(sizeof(int) * ts->device->num_comm_qubits);
+        scratch->traffic_edges = malloc(sizeof(uint32_t) * TS_ENERGY_CACHE_MAX_TRAFFIC);
+        check_alloc(6, scratch->cache->entries, scratch->cache->paths, scratch->cache->node_weights, scratch->cache->traffic,
+                    scratch->node_weights, scratch->traffic_edges);
+        scratch->cache->hits = 0;
+        scratch->cache->misses = 0;
+    }
+    scratch->weights_key = 0;
+    scratch->traffic_length = 0;
+    scratch->traffic_key_size = 0;
+    scratch->traffic_key = 0;
+
+    return scratch;
+}
+
+
+void telesabre_free_eval_scratch(eval_scratch_t* scratch) {
+    if (!scratch) return;
+    if (scratch->owns_layout) layout_free(scratch->layout);
+    layout_undo_free(scratch->undo);
+    telesabre_free_contracted_graph(scratch->contracted_graph);
+    free(scratch->traffic);
+    dijkstra_scratch_free(scratch->dijkstra);
+    path_free(scratch->path);
+    if (scratch->cache) {
+        free(scratch->cache->entries);
+        free(scratch->cache->paths);
+        free(scratch->cache->node_weights);
+        free(scratch->cache->traffic);
+        free(scratch->cache);
+        free(scratch->node_weights);
+        free(scratch->traffic_edges);
     }
+    free(scratch);
+}
+
+
+static uint64_t telesabre_weight_hash(int node, int weight) {
+    return hash_u64(((uint64_t)node << 32) | (uint32_t)weight);
+}
+
+
+// Starts the cache keys of a new evaluation of the run layout with a move applied to cores core1 
+// and core2 (-1 if none). Only their comm nodes can differ from the weights in the apsp tables, 
+// the weights key is updated for those. Traffic is rebuilt from empty.
+static void telesabre_reset_cache_keys(const telesabre_t* ts, eval_scratch_t* scratch, core_t core1, core_t core2) {
+    if (!scratch->cache) return;
+    const device_t* device = ts->device;
+    const int* base_weights = ts->apsp.node_weights;
+
+    memcpy(scratch->node_weights, base_weights, sizeof(int) * device->num_comm_qubits);
+    scratch->weights_key = ts->apsp.weights_key;
+    core_t cores[2] = {core1, core2 != core1 ? core2 : -1};
+    for (int c = 0; c < 2; c++) {
+        if (cores[c] < 0) continue;
+        for (int j = 0; j < device->core_num_comm_qubits[cores[c]]; j++) {
+            int node = device->comm_qubit_node_id[device->core_comm_qubits[cores[c]][j]];
+            int weight = telesabre_comm_node_weight(ts, scratch->layout, node);
+            if (weight == base_weights[node]) continue;
+            scratch->node_weights[node] = weight;
+            scratch->weights_key += telesabre_weight_hash(node, weight) - telesabre_weight_hash(node, base_weights[node]);
+        }
+    }
+
+    scratch->traffic_length = 0;
+    scratch->traffic_key_size = 0;
+    scratch->traffic_key = 0;
+}
+
+
+// Folds new traffic into the sorted edges. Path costs do not depend on the order the traffic was 
+// added in, but they do depend on its direction: only the source to target edge is raised.
+// False once the traffic is too long to cache.
+static bool telesabre_fold_cache_traffic(eval_scratch_t* scratch, size_t traffic_size) {
+    for (; scratch->traffic_key_size < traffic_size && scratch->traffic_length >= 0; scratch->traffic_key_size++) {
+        const int* t = scratch->traffic[scratch->traffic_key_size];
+        uint32_t code = ((uint32_t)t[0] << 16) | (uint32_t)t[1];
+        for (int w = 0; w < t[2]; w++) {
+            if (scratch->traffic_length == TS_ENERGY_CACHE_MAX_TRAFFIC) {
+                scratch->traffic_length = -1;
+                break;
+            }
+            int k = scratch->traffic_length++;
+            for (; k > 0 && scratch->traffic_edges[k - 1] > code; k--)
+                scratch->traffic_edges[k] = scratch->traffic_edges[k - 1];
+            scratch->traffic_edges[k] = code;
+            scratch->traffic_key += hash_u64(code);
+        }
+    }
+    return scratch->traffic_length >= 0;
+}
+
+
+static bool telesabre_energy_cache_entry_matches(const eval_scratch_t* scratch, const energy_cache_entry_t* entry, 
+                                                 uint64_t key, pqubit_t p1, pqubit_t p2, bool apsp) {
+    const energy_cache_t* cache = scratch->cache;
+    size_t slot = entry - cache->entries;
+    return entry->key == key && entry->p1 == p1 && entry->p2 == p2 && entry->apsp == apsp && entry->traffic_length == scratch->traffic_length &&
+           memcmp(&cache->node_weights[slot * cache->num_nodes], scratch->node_weights, sizeof(int) * cache->num_nodes) == 0 &&
+           memcmp(&cache->traffic[slot * TS_ENERGY_CACHE_MAX_TRAFFIC], scratch->traffic_edges, sizeof(uint32_t) * scratch->traffic_length) == 0;
+}
+
+
+static void telesabre_add_path_traffic(const telesabre_t* ts, eval_scratch_t* scratch, const node_t* nodes, size_t length, size_t* traffic_size) {
+    telesabre_reserve_eval_traffic(scratch, *traffic_size + length);
+    for (size_t k = 1; k < length; k++) {
+        int node_id_a = nodes[k-1];
+        int node_id_b = nodes[k];
+        if (node_id_a < ts->device->num_comm_qubits && node_id_b < ts->device->num_comm_qubits) {
+            scratch->traffic[*traffic_size][0] = node_id_a;
+            scratch->traffic[*traffic_size][1] = node_id_b;
+            scratch->traffic[*traffic_size][2] = 1;
+            (*traffic_size)++;
+        }
+    }
+}
+
+
+static int telesabre_separated_gate_energy(const telesabre_t* ts, eval_scratch_t* scratch, const gate_t* gate, size_t* traffic_size) {
+    energy_cache_t* cache = scratch->cache;
+    energy_cache_entry_t* entry = NULL;
+    uint64_t key = 0;
+    pqubit_t p1 = layout_get_phys(scratch->layout, gate->target_qubits[0]);
+    pqubit_t p2 = layout_get_phys(scratch->layout, gate->target_qubits[1]);
+    bool apsp = scratch->use_apsp && *traffic_size == 0;
+    if (cache && telesabre_fold_cache_traffic(scratch, *traffic_size)) {
+        key = hash_u64(scratch->weights_key ^ hash_u64(scratch->traffic_key ^ 
+                       hash_u64(((uint64_t)p1 << 33) | ((uint64_t)p2 << 1) | apsp))) | 1;
+        entry = &cache->entries[key & (TS_ENERGY_CACHE_ENTRIES - 1)];
+
+        if (telesabre_energy_cache_entry_matches(scratch, entry, key, p1, p2, apsp)) {
+            cache->hits++;
+            const node_t* nodes = &cache->paths[(entry - cache->entries) * cache->path_capacity];
+            telesabre_add_path_traffic(ts, scratch, nodes, entry->path_length, traffic_size);
+            return entry->energy;
+        }
+    }
+    if (cache) cache->misses++;
+
+    pqubit_t node_id_to_phys[2] = {0};
+    path_t* shortest_path = scratch->path;
+    telesabre_find_pair_path(ts, scratch, gate, scratch->traffic, *traffic_size, node_id_to_phys, shortest_path);
+    int gate_energy = shortest_path->distance;
+
+    if (entry) {
+        size_t slot = entry - cache->entries;
+        *entry = (energy_cache_entry_t){
+            .key = key,
+            .traffic_length = scratch->traffic_length,
+            .p1 = p1,
+            .p2 = p2,
+            .apsp = apsp,
+            .energy = gate_energy,
+            .path_length = shortest_path->length
+        };
+        memcpy(&cache->paths[slot * cache->path_capacity], shortest_path->nodes, sizeof(node_t) * shortest_path->length);
+        memcpy(&cache->node_weights[slot * cache->num_nodes], scratch->node_weights, sizeof(int) * cache->num_nodes);
+        memcpy(&cache->traffic[slot * TS_ENERGY_CACHE_MAX_TRAFFIC], scratch->traffic_edges, sizeof(uint32_t) * scratch->traffic_length);
+    }
+
+    telesabre_add_path_traffic(ts, scratch, shortest_path->nodes, shortest_path->length, traffic_size);
+
+    return gate_energy;
+}
+
+
+static void telesabre_reserve_base_traffic(telesabre_t* ts) {
+    if (ts->base_traffic_capacity >= ts->eval->traffic_capacity) return;
+    ts->base_traffic_capacity = ts->eval->traffic_capacity;
+    ts->base_traffic = realloc(ts->base_traffic, sizeof(int[3]) * ts->base_traffic_capacity);
+    check_alloc(1, ts->base_traffic);
+}
+
+
+static float telesabre_op_usage_penalty(const telesabre_t* ts, const op_t* op) {
+    if (op->type == OP_TELEGATE) return 1.0f;
 
     float usage_penalty = ts->usage_penalties[op->qubits[0]];
     for (int i = 0; i < op_get_num_qubits(op); i++) {
         float new_penalty = ts->usage_penalties[op->qubits[i]];
         usage_penalty = new_penalty > usage_penalty ? new_penalty : usage_penalty;
     }
-    if (op->type == OP_TELEGATE) {
-        usage_penalty = 1.0f;
+    return usage_penalty;
+}
+
+
+static float telesabre_combine_energy(const telesabre_t* ts, float front_energy, float extended_energy, int extended_set_size, float usage_penalty) {
+    float energy = front_energy;
+    if (!ts->safety_valve_activated) {
+        energy /= ts->front_size;
     }
+    if (extended_set_size > 0) {
+        energy += ts->config->extended_set_factor * extended_energy / extended_set_size;
+    }
+    return energy * usage_penalty;
+}
+
+
+// Exact within a core. A separated gate needs at least a way out of its core, 
+// one inter-core edge per core hop and a way into the other core.
+static int telesabre_gate_energy_lower_bound(const telesabre_t* ts, const layout_t* layout, const gate_t* gate) {
+    const device_t* device = ts->device;
+    pqubit_t p1 = layout_get_phys(layout, gate->target_qubits[0]);
+    pqubit_t p2 = layout_get_phys(layout, gate->target_qubits[1]);
+    core_t c1 = device->phys_to_core[p1];
+    core_t c2 = device->phys_to_core[p2];
+    if (c1 == c2) return abs(device_get_distance(device, p1, p2) - 1);
+
+    int hops = ts->core_hops[c1 * device->num_cores + c2];
+    if (hops >= TS_INF || ts->comm_exit_costs[p1] >= TS_INF || ts->comm_exit_costs[p2] >= TS_INF) return TS_INF;
+    return ts->comm_exit_costs[p1] + hops * ts->config->inter_core_edge_weight + ts->comm_exit_costs[p2];
+}
+
+
+// Lower bounds of the front and extended terms of the base gates in a layout
+static void telesabre_sum_energy_lower_bounds(const telesabre_t* ts, const layout_t* layout, long* front_out, long* extended_out, int* extended_set_size_out) {
+    long front = 0, extended = 0;
+    int extended_set_size = 0;
+    for (size_t k = 0; k < ts->num_base_energy_terms; k++) {
+        const energy_term_t* term = &ts->base_energy_terms[k];
+        int bound = telesabre_gate_energy_lower_bound(ts, layout, &ts->circuit->gates[term->gate_id]);
+        if (term->is_front) {
+            front += bound;
+        } else {
+            extended += bound;
+            extended_set_size++;
+        }
+    }
+    *front_out = front;
+    *extended_out = extended;
+    *extended_set_size_out = extended_set_size;
+}
+
+
+// Front and extended set energy of the current layout. If record_terms is set, 
+// the contribution of each gate is stored as base for delta evaluations.
+// With a finite budget, evaluation stops once the energy is known to exceed it, 
+// the outputs then add the lower bounds of the gates left out and the result is a bound above budget.
+// With front_only set, only the front slice is evaluated.
+static bool telesabre_evaluate_layout_energy(
+    const telesabre_t* ts,
+    eval_scratch_t* scratch,
+    bool front_only,
+    float budget,
+    float usage_penalty,
+    float* front_energy_out,
+    float* extended_energy_out,
+    int* extended_set_size_out,
+    energy_term_t* terms_out,
+    size_t* num_terms_out
+) {
+    const layout_t* layout = scratch->layout;
 
     size_t traffic_size = 0;
-    size_t traffic_capacity = 10;
-    int (*traffic)[3] = malloc(sizeof(int) * traffic_capacity * 3);
 
     float front_energy = 0.0f;
     float extended_energy = 0.0f;
 
     int extended_set_size = 0;
 
-    for (int i = 0; i < ts->num_remaining_slices && extended_set_size < ts->config->extended_set_size; i++) {
+    size_t num_terms = 0;
+
+    // Bounds of the gates not evaluated yet
+    bool bounded = budget < INFINITY && ts->base_energy_valid;
+    long front_bound = 0, extended_bound = 0;  // Integer sums, bounds may be TS_INF
+    int bounded_extended_set_size = 0;
+    if (bounded) telesabre_sum_energy_lower_bounds(ts, layout, &front_bound, &extended_bound, &bounded_extended_set_size);
+    bool pruned = false;
+
+    int num_slices = front_only && ts->num_remaining_slices > 0 ? 1 : ts->num_remaining_slices;
+    for (int i = 0; i < num_slices && extended_set_size < ts->config->extended_set_size && !pruned; i++) {
         size_t slice_start = ts->remaining_slices_ptr[i];
         size_t slice_end = ts->remaining_slices_ptr[i + 1];
 
@@ -397,7 +941,8 @@ float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op) {
             if (!gate_is_two_qubit(gate)) continue;
             if (ts->safety_valve_activated && ts->remaining_slices[j] != ts->front[0]) continue;
             
-            float gate_energy = 0.0f;
+            int gate_energy = 0;
+            size_t traffic_start = traffic_size;
             vqubit_t v1 = gate->target_qubits[0];
             vqubit_t v2 = gate->target_qubits[1];
             pqubit_t p1 = layout_get_phys(layout, v1);
@@ -407,36 +952,7 @@ float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op) {
             if (c1 == c2) {
                 gate_energy = abs(device_get_distance(ts->device, p1, p2) - 1);
             } else {
-                size_t separated_node_ids[2] = {0};
-                pqubit_t node_id_to_phys[2] = {0};
-
-                graph_t* contracted_graph = telesabre_build_contracted_graph_for_pair(
-                    ts, layout, gate, separated_node_ids, node_id_to_phys, traffic, traffic_size
-                );
-                
-                int src = separated_node_ids[0];
-                int dst = separated_node_ids[1];
-
-                path_t* shortest_path = graph_dijkstra(contracted_graph, src, dst);
-                gate_energy = shortest_path->distance;
-
-                // Collect traffic for the path
-                if (traffic_size + shortest_path->length > traffic_capacity) {
-                    traffic_capacity += 2*shortest_path->length;
-                    traffic = realloc(traffic, sizeof(int) * traffic_capacity * 3);
-                }
-                for (int k = 1; k < shortest_path->length; k++) {
-                    int node_id_a = shortest_path->nodes[k-1];
-                    int node_id_b = shortest_path->nodes[k];
-                    if (node_id_a < ts->device->num_comm_qubits && node_id_b < ts->device->num_comm_qubits) {
-                        traffic[traffic_size][0] = node_id_a;
-                        traffic[traffic_size][1] = node_id_b;
-                        traffic[traffic_size][2] = 1;
-                        traffic_size++;
-                    }
-                }
-                graph_free(contracted_graph);
-                path_free(shortest_path);
+                gate_energy = telesabre_separated_gate_energy(ts, scratch, gate, &traffic_size);
             }
 
             if (i == 0) {
@@ -446,6 +962,31 @@ float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op) {
                 extended_set_size++;
             }
 
+            if (bounded) {
+                int bound = telesabre_gate_energy_lower_bound(ts, layout, gate);
+                if (i == 0) front_bound -= bound;
+                else extended_bound -= bound;
+                if (c1 != c2 && telesabre_combine_energy(ts, front_energy + front_bound, extended_energy + extended_bound, 
+                                                         bounded_extended_set_size, usage_penalty) > budget) {
+                    front_energy += front_bound;
+                    extended_energy += extended_bound;
+                    extended_set_size = bounded_extended_set_size;
+                    pruned = true;
+                    break;
+                }
+            }
+
+            if (terms_out) {
+                terms_out[num_terms++] = (energy_term_t){
+                    .gate_id = ts->remaining_slices[j],
+                    .energy = gate_energy,
+                    .is_front = (i == 0),
+                    .separated = (c1 != c2),
+                    .traffic_start = traffic_start,
+                    .traffic_end = traffic_size
+                };
+            }
+
             // Consider only one gate in safety valve mode
             if (ts->safety_valve_activated) {
                 //if (front_energy <= 0.0f)
@@ -457,53 +998,352 @@ float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op) {
         if (ts->safety_valve_activated) break;
     }
 
-    float energy = front_energy;
-    if (!ts->safety_valve_activated) {
-        energy /= ts->front_size;
+    *front_energy_out = front_energy;
+    *extended_energy_out = extended_energy;
+    *extended_set_size_out = extended_set_size;
+    if (num_terms_out) *num_terms_out = num_terms;
+    return pruned;
+}
+
+
+void telesabre_evaluate_base_energy(telesabre_t* ts) {
+    float front_energy, extended_energy;
+    int extended_set_size;
+    ts->eval->use_apsp = ts->apsp.valid;
+    telesabre_reset_cache_keys(ts, ts->eval, -1, -1);
+    telesabre_evaluate_layout_energy(ts, ts->eval, false, INFINITY, 1.0f, &front_energy, &extended_energy, &extended_set_size, 
+                                     ts->base_energy_terms, &ts->num_base_energy_terms);
+
+    // Keep the traffic of the base layout, delta evaluations reuse it for unchanged paths
+    telesabre_reserve_base_traffic(ts);
+    size_t traffic_size = ts->num_base_energy_terms > 0 ? ts->base_energy_terms[ts->num_base_energy_terms - 1].traffic_end : 0;
+    memcpy(ts->base_traffic, ts->eval->traffic, sizeof(int[3]) * traffic_size);
+
+    for (int i = 0; i < ts->device->num_comm_qubits; i++)
+        ts->base_nearest_free_distances[i] = layout_get_nearest_free_distance(ts->layout, i);
+
+    ts->base_energy_valid = true;
+}
+
+
+float telesabre_evaluate_swap_energy_delta(const telesabre_t* ts, eval_scratch_t* scratch, const op_t* op, bool front_only, float budget) {
+    layout_t* layout = scratch->layout;
+    const device_t* device = ts->device;
+
+    vqubit_t moved_v1 = layout_get_virt(layout, op->qubits[0]);
+    vqubit_t moved_v2 = layout_get_virt(layout, op->qubits[1]);
+    layout_apply_swap_undoable(layout, op->qubits[0], op->qubits[1], scratch->undo);
+
+    // Contracted graph node weights change only if a nearest free distance in the swap core changed
+    bool node_weights_changed = false;
+    core_t core = device->phys_to_core[op->qubits[0]];
+    for (int i = 0; i < device->core_num_comm_qubits[core] && !node_weights_changed; i++) {
+        int pc_id = device->comm_qubit_node_id[device->core_comm_qubits[core][i]];
+        if (layout_get_nearest_free_distance(layout, pc_id) != ts->base_nearest_free_distances[pc_id])
+            node_weights_changed = true;
     }
-    if (extended_set_size > 0) {
-        energy += ts->config->extended_set_factor * extended_energy / extended_set_size;
+
+    scratch->use_apsp = ts->apsp.valid && !node_weights_changed;
+    telesabre_reset_cache_keys(ts, scratch, core, -1);
+
+    size_t traffic_size = 0;
+    bool traffic_diverged = false;
+
+    float front_energy = 0.0f;
+    float extended_energy = 0.0f;
+    int extended_set_size = 0;
+
+    float usage_penalty = telesabre_op_usage_penalty(ts, op);
+    bool bounded = budget < INFINITY;
+    long front_bound = 0, extended_bound = 0;
+    int bounded_extended_set_size = 0;
+    if (bounded) telesabre_sum_energy_lower_bounds(ts, layout, &front_bound, &extended_bound, &bounded_extended_set_size);
+    scratch->num_evaluations++;
+
+    // Terms are visited in base order so that float sums and traffic match a full evaluation
+    for (size_t k = 0; k < ts->num_base_energy_terms; k++) {
+        const energy_term_t* term = &ts->base_energy_terms[k];
+        if (front_only && !term->is_front) break;  // Front terms come first
+        const gate_t* gate = &ts->circuit->gates[term->gate_id];
+        bool moved = gate->target_qubits[0] == moved_v1 || gate->target_qubits[0] == moved_v2 ||
+                     gate->target_qubits[1] == moved_v1 || gate->target_qubits[1] == moved_v2;
+
+        int gate_energy = 0;
+        size_t base_traffic_size = term->traffic_end - term->traffic_start;
+        bool term_recomputed = false;
+        if (!moved && (!term->separated || (!node_weights_changed && !traffic_diverged))) {
+            // Same endpoints, same graph, same traffic so far: path is unchanged
+            gate_energy = term->energy;
+            telesabre_reserve_eval_traffic(scratch, traffic_size + base_traffic_size);
+            memcpy(scratch->traffic[traffic_size], ts->base_traffic[term->traffic_start], sizeof(int[3]) * base_traffic_size);
+            traffic_size += base_traffic_size;
+        } else {
+            size_t traffic_start = traffic_size;
+            pqubit_t p1 = layout_get_phys(layout, gate->target_qubits[0]);
+            pqubit_t p2 = layout_get_phys(layout, gate->target_qubits[1]);
+            if (device->phys_to_core[p1] == device->phys_to_core[p2]) {
+                gate_energy = abs(device_get_distance(device, p1, p2) - 1);
+            } else {
+                gate_energy = telesabre_separated_gate_energy(ts, scratch, gate, &traffic_size);
+                term_recomputed = true;
+            }
+
+            // A different path changes the traffic seen by all the following gates
+            if (!traffic_diverged) {
+                traffic_diverged = (traffic_size - traffic_start != base_traffic_size) ||
+                    memcmp(scratch->traffic[traffic_start], ts->base_traffic[term->traffic_start], sizeof(int[3]) * base_traffic_size) != 0;
+            }
+        }
+
+        if (term->is_front) {
+            front_energy += gate_energy;
+        } else {
+            extended_energy += gate_energy;
+            extended_set_size++;
+        }
+
+        // Reused terms are free, check the budget after each path search
+        if (bounded) {
+            int bound = telesabre_gate_energy_lower_bound(ts, layout, gate);
+            if (term->is_front) front_bound -= bound;
+            else extended_bound -= bound;
+            if (term_recomputed && telesabre_combine_energy(ts, front_energy + front_bound, extended_energy + extended_bound, 
+                                                            bounded_extended_set_size, usage_penalty) > budget) {
+                front_energy += front_bound;
+                extended_energy += extended_bound;
+                extended_set_size = bounded_extended_set_size;
+                scratch->num_pruned++;
+                break;
+            }
+        }
     }
-    energy *= usage_penalty;
 
-    layout_free(layout);
+    layout_undo(layout, scratch->undo);
 
-    //printf("Evaluating op: %d, energy: %.2f, front_energy: %.2f, extended_energy: %.2f, usage_penalty: %.2f\n",
-    //       (op->type), energy, front_energy, extended_energy, usage_penalty);
-    free(traffic);
-    return energy;
+    return telesabre_combine_energy(ts, front_energy, extended_energy, extended_set_size, usage_penalty);
 }
 
 
-void telesabre_add_candidate_op(telesabre_t* ts, const op_t* op) {
-    if (ts->num_candidate_ops >= ts->candidate_ops_capacity) {
-        ts->candidate_ops_capacity = (ts->candidate_ops_capacity == 0) ? 4 : ts->candidate_ops_capacity * 2;
-        ts->candidate_ops = realloc(ts->candidate_ops, sizeof(op_t) * ts->candidate_ops_capacity);
-        ts->candidate_ops_energies = realloc(ts->candidate_ops_energies, sizeof(float) * ts->candidate_ops_capacity);
+float telesabre_evaluate_op_energy(const telesabre_t* ts, eval_scratch_t* scratch, const op_t* op, bool front_only, float budget) {
+    if (op->type == OP_SWAP && ts->base_energy_valid) {
+        return telesabre_evaluate_swap_energy_delta(ts, scratch, op, front_only, budget);
     }
 
-    ts->candidate_ops[ts->num_candidate_ops] = *op;
+    // Apply op in place, it is undone before returning
+    layout_t* layout = scratch->layout;
+    const device_t* device = ts->device;
+    bool undo_needed = true;
+    if (op->type == OP_TELEPORT) {
+        layout_apply_teleport_undoable(layout, op->qubits[0], op->qubits[1], op->qubits[2], scratch->undo);
+        telesabre_reset_cache_keys(ts, scratch, device->phys_to_core[op->qubits[0]], device->phys_to_core[op->qubits[2]]);
+    } else if (op->type == OP_SWAP) {
+        layout_apply_swap_undoable(layout, op->qubits[0], op->qubits[1], scratch->undo);
+        telesabre_reset_cache_keys(ts, scratch, device->phys_to_core[op->qubits[0]], -1);
+    } else {
+        undo_needed = false;
+        telesabre_reset_cache_keys(ts, scratch, -1, -1);
+    }
+
+    // Moved qubits may change node weights, tables of the base layout cannot be used
+    scratch->use_apsp = ts->apsp.valid && !undo_needed;
+
+    float usage_penalty = telesabre_op_usage_penalty(ts, op);
+    float front_energy, extended_energy;
+    int extended_set_size;
+    scratch->num_evaluations++;
+    if (telesabre_evaluate_layout_energy(ts, scratch, front_only, budget, usage_penalty, &front_energy, &extended_energy, &extended_set_size, NULL, NULL))
+        scratch->num_pruned++;
+
+    if (undo_needed) layout_undo(layout, scratch->undo);
 
+    return telesabre_combine_energy(ts, front_energy, extended_energy, extended_set_size, usage_penalty);
+}
+
+
+// Candidates further than TS_ENERGY_PRUNE_MARGIN above the best energy so far can neither 
+// be nor tie with the best, so their evaluation may stop at a lower bound. 
+// Front only screening scores are exact, they rank candidates.
+static float telesabre_candidate_op_energy(const telesabre_t* ts, eval_scratch_t* scratch, const op_t* op, bool front_only, float best_energy) {
     int bonus = 0;
     if (op->type == OP_TELEPORT) {
         bonus = ts->config->teleport_bonus;
     } else if (op->type == OP_TELEGATE) {
         bonus = ts->config->telegate_bonus;
     }
-    
-    ts->candidate_ops_energies[ts->num_candidate_ops] = telesabre_evaluate_op_energy(ts, op) - bonus;
 
+    float budget = ts->config->enable_energy_pruning && !front_only ? best_energy + TS_ENERGY_PRUNE_MARGIN + bonus : INFINITY;
+    return telesabre_evaluate_op_energy(ts, scratch, op, front_only, budget) - bonus;
+}
+
+
+void telesabre_clear_candidate_ops(telesabre_t* ts) {
+    ts->num_candidate_ops = 0;
+    memset(ts->candidate_op_slots, -1, sizeof(int) * (ts->candidate_op_slots_mask + 1));
+}
+
+
+// Duplicates of a candidate are merged into it, keeping its front gate and combining the reasons
+void telesabre_add_candidate_op(telesabre_t* ts, const op_t* op) {
+    size_t slot = telesabre_candidate_op_hash(op) & ts->candidate_op_slots_mask;
+    for (; ts->candidate_op_slots[slot] >= 0; slot = (slot + 1) & ts->candidate_op_slots_mask) {
+        op_t* existing = &ts->candidate_ops[ts->candidate_op_slots[slot]];
+        if (!telesabre_candidate_ops_equal(existing, op)) continue;
+        existing->reasons |= op->reasons;
+        if (existing->front_gate_idx != op->front_gate_idx) existing->reasons |= OP_REASON_SHARED;
+        ts->num_merged_candidate_ops++;
+        return;
+    }
+
+    if (ts->num_candidate_ops >= ts->candidate_ops_capacity) {
+        ts->candidate_ops_capacity = (ts->candidate_ops_capacity == 0) ? 4 : ts->candidate_ops_capacity * 2;
+        ts->candidate_ops = realloc(ts->candidate_ops, sizeof(op_t) * ts->candidate_ops_capacity);
+        ts->candidate_ops_energies = realloc(ts->candidate_ops_energies, sizeof(float) * ts->candidate_ops_capacity);
+        ts->candidate_ops_front_energies = realloc(ts->candidate_ops_front_energies, sizeof(float) * ts->candidate_ops_capacity);
+        ts->best_operations = realloc(ts->best_operations, sizeof(op_t) * ts->candidate_ops_capacity);
+        ts->top_k_ops = realloc(ts->top_k_ops, sizeof(int) * ts->candidate_ops_capacity);
+        check_alloc(5, ts->candidate_ops, ts->candidate_ops_energies, ts->candidate_ops_front_energies, ts->best_operations, ts->top_k_ops);
+        telesabre_resize_candidate_op_slots(ts);
+        slot = telesabre_candidate_op_hash(op) & ts->candidate_op_slots_mask;
+        while (ts->candidate_op_slots[slot] >= 0) slot = (slot + 1) & ts->candidate_op_slots_mask;
+    }
+
+    ts->candidate_op_slots[slot] = ts->num_candidate_ops;
+    ts->candidate_ops[ts->num_candidate_ops] = *op;
     ts->num_candidate_ops++;
 }
 
 
+typedef struct {
+    const telesabre_t* ts;
+    const int* op_ids;  // Candidate ops to evaluate, all of them if NULL
+    int num_ops;
+    bool front_only;
+    float* energies;    // Indexed by candidate op
+    atomic_int next_op;
+    _Atomic float best_energy;  // Lowest energy found by any worker so far
+} candidate_eval_task_t;
+
+
+static void telesabre_evaluate_candidate_ops_task(void* arg, int worker_id) {
+    candidate_eval_task_t* task = arg;
+    const telesabre_t* ts = task->ts;
+    eval_scratch_t* scratch = ts->eval_workers[worker_id];
+
+    // The run layout is only read while workers are running
+    layout_copy_into(scratch->layout, ts->layout);
+    scratch->num_layout_copies++;
+
+    // Ops are claimed in small chunks, each energy is stored at the op index
+    while (true) {
+        int start = atomic_fetch_add(&task->next_op, TS_EVAL_CHUNK_SIZE);
+        if (start >= task->num_ops) break;
+        int end = start + TS_EVAL_CHUNK_SIZE < task->num_ops ? start + TS_EVAL_CHUNK_SIZE : task->num_ops;
+        for (int i = start; i < end; i++) {
+            int op_id = task->op_ids ? task->op_ids[i] : i;
+            float best_energy = atomic_load_explicit(&task->best_energy, memory_order_relaxed);
+            float energy = telesabre_candidate_op_energy(ts, scratch, &ts->candidate_ops[op_id], task->front_only, best_energy);
+            task->energies[op_id] = energy;
+            while (energy < best_energy && 
+                   !atomic_compare_exchange_weak_explicit(&task->best_energy, &best_energy, energy, memory_order_relaxed, memory_order_relaxed));
+        }
+    }
+}
+
+
+// Energies within TS_ENERGY_PRUNE_MARGIN of the best do not depend on evaluation order, so the 
+// parallel result is the same as the serial one and op selection stays deterministic. 
+// Only the lower bounds reported for pruned candidates may differ.
+static void telesabre_evaluate_candidate_op_subset(telesabre_t* ts, const int* op_ids, int num_ops, bool front_only, float* energies) {
+    if (!ts->pool || num_ops < TS_EVAL_PARALLEL_MIN_OPS) {
+        float best_energy = INFINITY;
+        for (int i = 0; i < num_ops; i++) {
+            int op_id = op_ids ? op_ids[i] : i;
+            float energy = telesabre_candidate_op_energy(ts, ts->eval, &ts->candidate_ops[op_id], front_only, best_energy);
+            energies[op_id] = energy;
+            if (energy < best_energy) best_energy = energy;
+        }
+        return;
+    }
+
+    candidate_eval_task_t task = {.ts = ts, .op_ids = op_ids, .num_ops = num_ops, .front_only = front_only, .energies = energies};
+    atomic_init(&task.next_op, 0);
+    atomic_init(&task.best_energy, INFINITY);
+    thread_pool_run(ts->pool, telesabre_evaluate_candidate_ops_task, &task);
+}
+
+
+// Indices of the k candidates with the lowest front scores, ties to the lower index, 
+// returned in op order so that energy ties resolve as in a full evaluation
+static void telesabre_select_top_k_ops(telesabre_t* ts, int k) {
+    const float* scores = ts->candidate_ops_front_energies;
+    int* top = ts->top_k_ops;
+    int num_top = 0;
+    for (int i = 0; i < ts->num_candidate_ops; i++) {
+        if (num_top == k && scores[i] >= scores[top[k - 1]]) continue;
+        int j = num_top < k ? num_top++ : k - 1;
+        while (j > 0 && scores[top[j - 1]] > scores[i]) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = i;
+    }
+
+    for (int i = 1; i < k; i++) {
+        int op_id = top[i];
+        int j = i;
+        for (; j > 0 && top[j - 1] > op_id; j--) top[j] = top[j - 1];
+        top[j] = op_id;
+    }
+}
+
+
+// With top_k_candidates set, all candidates are screened on the front term alone and only the 
+// best k get the full lookahead, the others keep TS_INF. The audit evaluates the cut candidates 
+// too and counts the iterations where one of them would have been, or tied with, the best.
+void telesabre_evaluate_candidate_ops(telesabre_t* ts) {
+    int k = ts->config->top_k_candidates;
+    ts->top_k_screened = k > 0 && ts->num_candidate_ops > k;
+    if (!ts->top_k_screened) {
+        telesabre_evaluate_candidate_op_subset(ts, NULL, ts->num_candidate_ops, false, ts->candidate_ops_energies);
+        return;
+    }
+
+    telesabre_evaluate_candidate_op_subset(ts, NULL, ts->num_candidate_ops, true, ts->candidate_ops_front_energies);
+    telesabre_select_top_k_ops(ts, k);
+
+    for (int i = 0; i < ts->num_candidate_ops; i++)
+        ts->candidate_ops_energies[i] = TS_INF;
+    telesabre_evaluate_candidate_op_subset(ts, ts->top_k_ops, k, false, ts->candidate_ops_energies);
+    ts->stats.num_top_k_cuts++;
+
+    if (!ts->config->audit_top_k_candidates) return;
+
+    float best_energy = TS_INF;
+    for (int i = 0; i < k; i++)
+        if (ts->candidate_ops_energies[ts->top_k_ops[i]] < best_energy) best_energy = ts->candidate_ops_energies[ts->top_k_ops[i]];
+
+    int next_top = 0;
+    for (int i = 0; i < ts->num_candidate_ops; i++) {
+        if (next_top < k && ts->top_k_ops[next_top] == i) {
+            next_top++;
+            continue;
+        }
+        float energy = telesabre_candidate_op_energy(ts, ts->eval, &ts->candidate_ops[i], false, best_energy);
+        if (energy < best_energy + TS_ENERGY_TIE_TOLERANCE) {
+            ts->stats.num_top_k_changed++;
+            break;
+        }
+    }
+}
+
+
 void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
     const circuit_t* circuit = ts->circuit;
     const device_t* device = ts->device;
     const layout_t* layout = ts->layout;
 
     // Find feasible inter-core operations
-    ts->num_candidate_ops = 0;
+    telesabre_clear_candidate_ops(ts);
 
     for (int i = 0; i < ts->num_attraction_paths; i++) {
         int front_gate_idx = ts->attraction_paths_front_idx[i];
@@ -522,7 +1362,7 @@ void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
                 device_has_edge(device, g1, m1) && device_has_edge(device, m2, g2)) {
 
                 // Add telegate operation
-                op_t telegate_op = {.type = OP_TELEGATE, .qubits = {g1, m1, m2, g2}, .front_gate_idx = front_gate_idx};
+                op_t telegate_op = {.type = OP_TELEGATE, .qubits = {g1, m1, m2, g2}, .front_gate_idx = front_gate_idx, .reasons = OP_REASON_TELEGATE};
                 telesabre_add_candidate_op(ts, &telegate_op);
             }
         }
@@ -545,7 +1385,7 @@ void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
                 layout_get_core_remaining_capacity(layout, fwd_target_core) >= 2) {
                 
                 // Add teleport operation
-                op_t teleport_op = {.type = OP_TELEPORT, .qubits = {fwd_source, fwd_mediator, fwd_target, 0}, .front_gate_idx = front_gate_idx};
+                op_t teleport_op = {.type = OP_TELEPORT, .qubits = {fwd_source, fwd_mediator, fwd_target, 0}, .front_gate_idx = front_gate_idx, .reasons = OP_REASON_FORWARD};
                 telesabre_add_candidate_op(ts, &teleport_op);
             }
 
@@ -562,7 +1402,7 @@ void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
                 layout_get_core_remaining_capacity(layout, rev_target_core) >= 2) {
                 
                 // Add teleport operation
-                op_t teleport_op = {.type = OP_TELEPORT, .qubits = {rev_source, rev_mediator, rev_target, 0}, .front_gate_idx = front_gate_idx};
+                op_t teleport_op = {.type = OP_TELEPORT, .qubits = {rev_source, rev_mediator, rev_target, 0}, .front_gate_idx = front_gate_idx, .reasons = OP_REASON_REVERSE};
                 telesabre_add_candidate_op(ts, &teleport_op);
             }
 
@@ -583,14 +1423,13 @@ void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
                     device->qubit_is_comm[fwd_mediator] && layout_is_phys_free(layout, fwd_mediator) &&
                     device->qubit_is_comm[fwd_target] && layout_is_phys_free(layout, fwd_target)) {
                     
-                    for (int e = 0; e < ts->device->qubit_num_edges[fwd_target]; e++) {
-                        pqubit_t edge_p1 = ts->device->qubit_to_edges[fwd_target][e].p1;
-                        pqubit_t edge_p2 = ts->device->qubit_to_edges[fwd_target][e].p2;
-
-                        pqubit_t other_phys = (edge_p1 == fwd_target) ? edge_p2 : edge_p1;
+                    // Teleports through fwd_target back to fwd_mediator
+                    for (int e = device->tp_edge_offsets[fwd_target]; e < device->tp_edge_offsets[fwd_target + 1]; e++) {
+                        if (device->tp_edges[e].p_target != fwd_mediator) continue;
+                        pqubit_t other_phys = device->tp_edges[e].p_source;
                         if (!layout_is_phys_free(layout, other_phys)) {
                             // Add reverse teleport operation
-                            op_t reverse_teleport_op = {.type = OP_TELEPORT, .qubits = {other_phys, fwd_target, fwd_mediator, 0}, .front_gate_idx = front_gate_idx};
+                            op_t reverse_teleport_op = {.type = OP_TELEPORT, .qubits = {other_phys, fwd_target, fwd_mediator, 0}, .front_gate_idx = front_gate_idx, .reasons = OP_REASON_CORE_EMPTYING | OP_REASON_FORWARD};
                             telesabre_add_candidate_op(ts, &reverse_teleport_op);
                         }
                     }
@@ -601,14 +1440,13 @@ void telesabre_collect_candidate_tele_ops(telesabre_t *ts) {
                     device->qubit_is_comm[rev_mediator] && layout_is_phys_free(layout, rev_mediator) &&
                     device->qubit_is_comm[rev_target] && layout_is_phys_free(layout, rev_target)) {
                     
-                    for (int e = 0; e < ts->device->qubit_num_edges[rev_target]; e++) {
-                        pqubit_t edge_p1 = ts->device->qubit_to_edges[rev_target][e].p1;
-                        pqubit_t edge_p2 = ts->device->qubit_to_edges[rev_target][e].p2;
-
-                        pqubit_t other_phys = (edge_p1 == rev_target) ? edge_p2 : edge_p1;
+                    // Teleports through rev_target back to rev_mediator
+                    for (int e = device->tp_edge_offsets[rev_target]; e < device->tp_edge_offsets[rev_target + 1]; e++) {
+                        if (device->tp_edges[e].p_target != rev_mediator) continue;
+                        pqubit_t other_phys = device->tp_edges[e].p_source;
                         if (!layout_is_phys_free(layout, other_phys)) {
                             // Add reverse teleport operation
-                            op_t reverse_teleport_op = {.type = OP_TELEPORT, .qubits = {other_phys, rev_target, rev_mediator, 0}, .front_gate_idx = front_gate_idx};
+                            op_t reverse_teleport_op = {.type = OP_TELEPORT, .qubits = {other_phys, rev_target, rev_mediator, 0}, .front_gate_idx = front_gate_idx, .reasons = OP_REASON_CORE_EMPTYING | OP_REASON_REVERSE};
                             telesabre_add_candidate_op(ts, &reverse_teleport_op);
                         }
                     }
@@ -697,6 +1535,7 @@ void telesabre_apply_candidate_op(telesabre_t *ts, const op_t *op) {
     if (op->type == OP_TELEPORT) 
     {
         layout_apply_teleport(ts->layout, op->qubits[0], op->qubits[1], op->qubits[2]);
+        telesabre_update_ready_gates(ts, op->qubits, 3);
         for (int i = 0; i < 3; i++) 
             ts->usage_penalties[op->qubits[i]] += ts->config->teledata_usage_penalty;
 
@@ -705,6 +1544,7 @@ void telesabre_apply_candidate_op(telesabre_t *ts, const op_t *op) {
     else if (op->type == OP_SWAP) 
     {
         layout_apply_swap(ts->layout, op->qubits[0], op->qubits[1]);
+        telesabre_update_ready_gates(ts, op->qubits, 2);
         for (int i = 0; i < 2; i++) 
             ts->usage_penalties[op->qubits[i]] += ts->config->swap_usage_penalty;
         ts->result.num_swaps++;
@@ -715,10 +1555,14 @@ void telesabre_apply_candidate_op(telesabre_t *ts, const op_t *op) {
             ts->usage_penalties[op->qubits[i]] += ts->config->telegate_usage_penalty;
         int front_gate_idx = op->front_gate_idx;
         ts->result.num_telegate++;
+        if (ts->trace) 
+            trace_instant(ts->trace, "telegate", monotonic_seconds(), "\"iteration\": %d, \"qubits\": [%d, %d, %d, %d]", 
+                          ts->it, op->qubits[0], op->qubits[1], op->qubits[2], op->qubits[3]);
         telesabre_execute_front_gate(ts, front_gate_idx);
         telesabre_made_progress(ts);
     }
 
+    if (!log_enabled(LOG_DEBUG)) return;
     printf(H2COL"  Applied operation: "CRESET);
     if (op->type == OP_TELEPORT) {
         printf("Teleport(%d, %d, %d)\n", op->qubits[0], op->qubits[1], op->qubits[2]);
@@ -730,34 +1574,12 @@ void telesabre_apply_candidate_op(telesabre_t *ts, const op_t *op) {
 }
 
 
-graph_t* telesabre_build_contracted_graph_for_pair(
-    const telesabre_t* ts,
-    const layout_t* layout,
-    const gate_t* gate, 
-    size_t node_ids_out[2],
-    pqubit_t* node_id_to_phys_out,
-    const int traffic[][3],
-    size_t num_traffic
-) {
+contracted_graph_t* telesabre_new_contracted_graph(const telesabre_t* ts) {
     const device_t* device = ts->device;
-    int node_id = device->num_comm_qubits;
-
-    for (int i = 0; i < gate->num_target_qubits; i++) {
-        pqubit_t p = layout_get_phys(layout, gate->target_qubits[i]);
-        node_ids_out[i] = node_id;
-        node_id_to_phys_out[i] = p;
-        node_id++;
-    }
 
-    graph_t* graph = graph_new(node_id);
-
-    pqubit_t start_qubit = layout_get_phys(layout, gate->target_qubits[0]);
-    pqubit_t end_qubit = layout_get_phys(layout, gate->target_qubits[1]);
-
-    core_t start_core = device->phys_to_core[start_qubit];
-    core_t end_core = device->phys_to_core[end_qubit];
-    
-    // Edge Weights
+    // Communication qubit nodes followed by the two gate qubit nodes
+    contracted_graph_t* cg = malloc(sizeof(contracted_graph_t));
+    cg->graph = graph_new(device->num_comm_qubits + 2);
     
     // Add edges between communication qubits in same core
     for (int c = 0; c < device->num_cores; c++) {
@@ -773,7 +1595,7 @@ graph_t* telesabre_build_contracted_graph_for_pair(
 
                 if (pc1_node == pc2_node) continue;
 
-                graph_add_edge(graph, pc1_node, pc2_node, distance);
+                graph_add_edge(cg->graph, pc1_node, pc2_node, distance);
             }
         }
     }
@@ -788,17 +1610,241 @@ graph_t* telesabre_build_contracted_graph_for_pair(
         int pc1_node = device->comm_qubit_node_id[pc1];
         int pc2_node = device->comm_qubit_node_id[pc2];
 
-        core_t pc1_core = device->phys_to_core[pc1];
-        core_t pc2_core = device->phys_to_core[pc2];
+        graph_add_edge(cg->graph, pc1_node, pc2_node, distance);
+    }
+
+    cg->skeleton_degrees = malloc(sizeof(size_t) * cg->graph->num_nodes);
+    for (size_t i = 0; i < cg->graph->num_nodes; i++)
+        cg->skeleton_degrees[i] = cg->graph->adj[i].degree;
+
+    // Room for the gate qubit overlay: one edge to the end node per comm qubit, 
+    // start node edges to all comm qubits of its core
+    int max_core_comm_qubits = 0;
+    for (int c = 0; c < device->num_cores; c++)
+        if (device->core_num_comm_qubits[c] > max_core_comm_qubits) max_core_comm_qubits = device->core_num_comm_qubits[c];
+    for (int i = 0; i < device->num_comm_qubits; i++)
+        graph_reserve_node_edges(cg->graph, i, cg->skeleton_degrees[i] + 1);
+    graph_reserve_node_edges(cg->graph, device->num_comm_qubits, max_core_comm_qubits);
+
+    cg->traffic_patches_capacity = ts->max_traffic;
+    cg->traffic_patches = malloc(sizeof(edge_patch_t) * cg->traffic_patches_capacity);
+    check_alloc(1, cg->traffic_patches);
+    cg->num_traffic_patches = 0;
+
+    return cg;
+}
+
+
+// Removes the gate qubit edges and traffic of the previous pair query, traffic in reverse order
+static void telesabre_clear_contracted_graph_overlay(contracted_graph_t* cg) {
+    for (size_t i = cg->num_traffic_patches; i > 0; i--)
+        cg->traffic_patches[i - 1].edge->weight = cg->traffic_patches[i - 1].weight;
+    cg->num_traffic_patches = 0;
+    for (size_t i = 0; i < cg->graph->num_nodes; i++)
+        graph_truncate_node_edges(cg->graph, i, cg->skeleton_degrees[i]);
+}
 
-        //if (layout_get_core_remaining_capacity(layout, pc1_core) <= 1 ||
-        //    layout_get_core_remaining_capacity(layout, pc2_core) <= 1) {
-        //    distance += ts->config->full_core_penalty * 100;
-        //}
 
-        graph_add_edge(graph, pc1_node, pc2_node, distance);
+void telesabre_free_contracted_graph(contracted_graph_t* cg) {
+    if (!cg) return;
+    graph_free(cg->graph);
+    free(cg->skeleton_degrees);
+    free(cg->traffic_patches);
+    free(cg);
+}
+
+
+static int telesabre_comm_node_weight(const telesabre_t* ts, const layout_t* layout, int comm_node) {
+    int weight = 0;
+
+    // Free qubit distance penalty
+    weight += layout_get_nearest_free_distance(layout, comm_node);
+
+    // Full core penalty
+    core_t core = ts->device->phys_to_core[ts->device->comm_qubits[comm_node]];
+    if (layout_get_core_remaining_capacity(layout, core) <= 2) {
+        weight += ts->config->full_core_penalty;
     }
 
+    return weight;
+}
+
+
+// Tables are rebuilt only when a node weight changed, the skeleton edges are fixed
+void telesabre_update_comm_apsp(telesabre_t* ts) {
+    comm_apsp_t* apsp = &ts->apsp;
+    contracted_graph_t* cg = ts->eval->contracted_graph;
+    const graph_t* graph = cg->graph;
+    const int n = ts->device->num_comm_qubits;
+    int* dist = apsp->dist;
+    int* next = apsp->next;
+
+    bool changed = apsp->epoch == 0;
+    for (int i = 0; i < n; i++) {
+        int weight = telesabre_comm_node_weight(ts, ts->layout, i);
+        if (weight != apsp->node_weights[i]) changed = true;
+        apsp->node_weights[i] = weight;
+    }
+    apsp->valid = true;
+    if (!changed) return;
+    apsp->epoch++;
+
+    apsp->weights_key = 0;
+    for (int i = 0; i < n; i++)
+        apsp->weights_key += telesabre_weight_hash(i, apsp->node_weights[i]);
+
+    telesabre_clear_contracted_graph_overlay(cg);
+
+    for (int i = 0; i < n * n; i++) {
+        dist[i] = TS_INF;
+        next[i] = -1;
+    }
+    for (int u = 0; u < n; u++) {
+        dist[u * n + u] = 0;
+        next[u * n + u] = u;
+        // Skeleton edges only, the gate qubit overlay is not part of the tables
+        for (size_t e = 0; e < cg->skeleton_degrees[u]; e++) {
+            int v = graph->adj[u].edges[e].to;
+            int cost = graph->adj[u].edges[e].weight + apsp->node_weights[v];
+            if (cost < dist[u * n + v]) {
+                dist[u * n + v] = cost;
+                next[u * n + v] = v;
+            }
+        }
+    }
+
+    // Floyd-Warshall with next hops, the graph has only a few comm qubits per core
+    for (int k = 0; k < n; k++) {
+        for (int i = 0; i < n; i++) {
+            int d_ik = dist[i * n + k];
+            if (d_ik >= TS_INF) continue;
+            for (int j = 0; j < n; j++) {
+                int d_kj = dist[k * n + j];
+                if (d_kj >= TS_INF) continue;
+                if (d_ik + d_kj < dist[i * n + j]) {
+                    dist[i * n + j] = d_ik + d_kj;
+                    next[i * n + j] = next[i * n + k];
+                }
+            }
+        }
+    }
+}
+
+
+// Pair query answered from the all-pairs tables: 
+// min over start core comm i and end core comm j of start->i + d(i,j) + j->end
+static void telesabre_apsp_pair_path(const telesabre_t* ts, pqubit_t start_qubit, pqubit_t end_qubit, path_t* path) {
+    const device_t* device = ts->device;
+    const comm_apsp_t* apsp = &ts->apsp;
+    const int n = device->num_comm_qubits;
+    core_t start_core = device->phys_to_core[start_qubit];
+    core_t end_core = device->phys_to_core[end_qubit];
+
+    int best_distance = TS_INF;
+    int best_first = -1, best_last = -1, best_first_cost = 0, best_last_cost = 0;
+    for (int a = 0; a < device->core_num_comm_qubits[start_core]; a++) {
+        pqubit_t pc_a = device->core_comm_qubits[start_core][a];
+        int i = device->comm_qubit_node_id[pc_a];
+        int first_cost = abs(device_get_distance(device, start_qubit, pc_a) - 1) + apsp->node_weights[i];
+
+        for (int b = 0; b < device->core_num_comm_qubits[end_core]; b++) {
+            pqubit_t pc_b = device->core_comm_qubits[end_core][b];
+            int j = device->comm_qubit_node_id[pc_b];
+            if (apsp->dist[i * n + j] >= TS_INF) continue;
+
+            int last_cost = abs(device_get_distance(device, end_qubit, pc_b) - 1);
+            int distance = first_cost + apsp->dist[i * n + j] + last_cost;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_first = i;
+                best_last = j;
+                best_first_cost = first_cost;
+                best_last_cost = last_cost;
+            }
+        }
+    }
+
+    if (best_first == -1) {
+        path->length = 0;
+        path->distance = TS_INF;
+        return;
+    }
+
+    // Gate qubit nodes plus the comm nodes of the chain
+    size_t length = 3;
+    for (int cur = best_first; cur != best_last; cur = apsp->next[cur * n + best_last]) length++;
+
+    path->length = length;
+    path->distance = best_distance;
+
+    size_t k = 0;
+    path->nodes[k] = n;
+    path->distances[k++] = best_first_cost;
+    int cur = best_first;
+    while (cur != best_last) {
+        int nxt = apsp->next[cur * n + best_last];
+        path->nodes[k] = cur;
+        path->distances[k++] = apsp->dist[cur * n + nxt];
+        cur = nxt;
+    }
+    path->nodes[k] = best_last;
+    path->distances[k++] = best_last_cost;
+    path->nodes[k] = n + 1;
+}
+
+
+void telesabre_find_pair_path(const telesabre_t* ts, eval_scratch_t* scratch, const gate_t* gate, const int traffic[][3], size_t num_traffic, pqubit_t node_id_to_phys_out[2], path_t* path_out) {
+    pqubit_t start_qubit = layout_get_phys(scratch->layout, gate->target_qubits[0]);
+    pqubit_t end_qubit = layout_get_phys(scratch->layout, gate->target_qubits[1]);
+
+    if (scratch->use_apsp && num_traffic == 0) {
+        node_id_to_phys_out[0] = start_qubit;
+        node_id_to_phys_out[1] = end_qubit;
+        telesabre_apsp_pair_path(ts, start_qubit, end_qubit, path_out);
+        scratch->num_apsp_lookups++;
+        return;
+    }
+
+    size_t separated_node_ids[2] = {0};
+    graph_t* contracted_graph = telesabre_build_contracted_graph_for_pair(
+        ts, scratch->contracted_graph, scratch->layout, gate, separated_node_ids, node_id_to_phys_out, traffic, num_traffic
+    );
+    graph_dijkstra_into(contracted_graph, separated_node_ids[0], separated_node_ids[1], scratch->dijkstra, path_out);
+    scratch->num_dijkstra_calls++;
+}
+
+
+graph_t* telesabre_build_contracted_graph_for_pair(
+    const telesabre_t* ts,
+    contracted_graph_t* cg,
+    const layout_t* layout,
+    const gate_t* gate, 
+    size_t node_ids_out[2],
+    pqubit_t* node_id_to_phys_out,
+    const int traffic[][3],
+    size_t num_traffic
+) {
+    const device_t* device = ts->device;
+    graph_t* graph = cg->graph;
+    int node_id = device->num_comm_qubits;
+
+    for (int i = 0; i < gate->num_target_qubits; i++) {
+        pqubit_t p = layout_get_phys(layout, gate->target_qubits[i]);
+        node_ids_out[i] = node_id;
+        node_id_to_phys_out[i] = p;
+        node_id++;
+    }
+
+    telesabre_clear_contracted_graph_overlay(cg);
+
+    pqubit_t start_qubit = layout_get_phys(layout, gate->target_qubits[0]);
+    pqubit_t end_qubit = layout_get_phys(layout, gate->target_qubits[1]);
+
+    core_t start_core = device->phys_to_core[start_qubit];
+    core_t end_core = device->phys_to_core[end_qubit];
+    
+    // Edge Weights
+
     // Add edges from start qubit to all communication qubits in the same core
     for (int j = 0; j < device->core_num_comm_qubits[start_core]; j++) {
         pqubit_t pc = device->core_comm_qubits[start_core][j];
@@ -826,23 +1872,18 @@ graph_t* telesabre_build_contracted_graph_for_pair(
     // Node Weights
 
     for (int i = 0; i < device->num_comm_qubits; i++) {
-        pqubit_t pc = device->comm_qubits[i];
-        graph_set_node_weight(graph, i, 0);
-        
-        // Free qubit distance penalty
-        int nearest_free_distance = heap_get_min(layout->nearest_free_qubits[i]).priority;
-        graph_increase_node_weight(graph, i, nearest_free_distance);
-
-        // Full core penalty
-        core_t core = device->phys_to_core[pc];
-        if (layout_get_core_remaining_capacity(layout, core) <= 2) {
-            graph_increase_node_weight(graph, i, ts->config->full_core_penalty);
-        }
+        graph_set_node_weight(graph, i, telesabre_comm_node_weight(ts, layout, i));
     }
 
     // Traffic
 
     if (traffic) {
+        if (num_traffic > cg->traffic_patches_capacity) {
+            cg->traffic_patches_capacity = 2 * num_traffic;
+            cg->traffic_patches = realloc(cg->traffic_patches, sizeof(edge_patch_t) * cg->traffic_patches_capacity);
+            check_alloc(1, cg->traffic_patches);
+        }
+
         for (size_t i = 0; i < num_traffic; i++) {
             int src_node = device->comm_qubit_node_id[traffic[i][0]];
             int dst_node = device->comm_qubit_node_id[traffic[i][1]];
@@ -852,8 +1893,11 @@ graph_t* telesabre_build_contracted_graph_for_pair(
                 continue; // Invalid traffic
             }
 
-            // Increase edge weight for traffic
-            graph_increase_edge_weight(graph, src_node, dst_node, traffic_weight);
+            // Increase edge weight for traffic, remembering the old weight
+            edge_t* edge = graph_get_edge(graph, src_node, dst_node);
+            if (!edge) continue;
+            cg->traffic_patches[cg->num_traffic_patches++] = (edge_patch_t){.edge = edge, .weight = edge->weight};
+            edge->weight += traffic_weight;
         }
     }
 
@@ -873,12 +1917,12 @@ void telesabre_reset_usage_penalties(telesabre_t* ts) {
 }
 
 
-void telesabre_step_free(telesabre_t* ts) {
-    // Free attraction paths
-    for (int i = 0; i < ts->num_attraction_paths; i++) {
-        path_free(ts->attraction_paths[i]);
-        ts->attraction_paths[i] = NULL;
-    }
+// Adds the phase time to its total and traces it, returns the end time as the start of the next phase
+static double telesabre_end_phase(telesabre_t* ts, const char* name, double* total_seconds, double start) {
+    double end = monotonic_seconds();
+    *total_seconds += end - start;
+    if (ts->trace) trace_span(ts->trace, name, start, end);
+    return end;
 }
 
 
@@ -887,179 +1931,326 @@ void telesabre_step(telesabre_t* ts) {
     const device_t* device = ts->device;
     const circuit_t* circuit = ts->circuit;
 
-    layout_print(ts->layout);
+    if (log_enabled(LOG_TRACE))
+        layout_print(ts->layout);
 
     telesabre_safety_valve_check(ts);
+    ts->stats.num_iterations++;
+    if (ts->safety_valve_activated) ts->stats.num_safety_valve_iterations++;
 
     // Debug Print
-    int num_remaining_gates = 0;
-    for (int i = 0; i < circuit->num_gates; i++)
-        if (ts->gate_num_remaining_parents[i] != (size_t)-1)
-            num_remaining_gates++;
-    printf(H1COL"\nIteration %d - Remaining Slices: %zu - Remaining Gates: %d/%zu" CRESET, 
-        ts->it, ts->num_remaining_slices, num_remaining_gates, circuit->num_gates);
-    if (ts->safety_valve_activated) {
-        printf(" - "BHCYN"Safety Valve ON\n"CRESET);
-    } else {
-        printf("\n");
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H1COL"\nIteration %d - Sliced Ahead: %zu - Remaining Gates: %zu/%zu" CRESET, 
+            ts->it, ts->num_remaining_slices, ts->num_remaining_gates, circuit->num_gates);
+        if (ts->safety_valve_activated) {
+            printf(" - "BHCYN"Safety Valve ON\n"CRESET);
+        } else {
+            printf("\n");
+        }
     }
 
-    // Run front gates that can be run according to current layout
-    bool found_executable_gate;
+    // Run front gates that can be run according to current layout, first in front order
+    double phase_start = monotonic_seconds();
+    double step_start = phase_start;
     ts->num_applied_gates = 0;
-    do {
-        found_executable_gate = false;
-        // Search for runnable gates in front
+    while (ts->num_ready_gates > 0) {
+        size_t best = 0;
+        for (size_t i = 1; i < ts->num_ready_gates; i++)
+            if (ts->gate_front_pos[ts->ready_gates[i]] < ts->gate_front_pos[ts->ready_gates[best]])
+                best = i;
+        size_t gate_id = ts->ready_gates[best];
+        ts->applied_gates[ts->num_applied_gates++] = gate_id;
+        telesabre_execute_front_gate(ts, ts->gate_front_pos[gate_id]);
+        telesabre_made_progress(ts);
+    }
+    telesabre_end_phase(ts, "gate_scan", &ts->stats.gate_scan_seconds, phase_start);
+
+    // Debug Print front
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H2COL"  Front size: "CRESET"%zu\n", ts->front_size);
         for (int i = 0; i < ts->front_size; i++) {
             const gate_t* gate = &circuit->gates[ts->front[i]];
-            if (layout_can_execute_gate(ts->layout, gate)) {
-                ts->applied_gates[ts->num_applied_gates++] = ts->front[i];
-                telesabre_execute_front_gate(ts, i);
-                telesabre_made_progress(ts);
-                found_executable_gate = true;
-                break;
+            printf("    (%*zu): Virt: ", 3, ts->front[i]);
+            for (int j = 0; j < gate->num_target_qubits; j++) {
+                printf("%*d ", 3, gate->target_qubits[j]);
             }
+            printf(" - Phys: ");
+            for (int j = 0; j < gate->num_target_qubits; j++) {
+                pqubit_t phys_qubit = layout_get_phys(ts->layout, gate->target_qubits[j]);
+                printf("%*d ", 3, phys_qubit);
+            }
+            printf(" - Cores: ");
+            for (int j = 0; j < gate->num_target_qubits; j++) {
+                pqubit_t phys_qubit = layout_get_phys(ts->layout, gate->target_qubits[j]);
+                core_t core = device->phys_to_core[phys_qubit];
+                printf("%*d ", 3, core);
+            }
+            printf("\n");
         }
-    } while(found_executable_gate && ts->front_size > 0);
-
-    // Debug Print front
-    printf(H2COL"  Front size: "CRESET"%zu\n", ts->front_size);
-    for (int i = 0; i < ts->front_size; i++) {
-        const gate_t* gate = &circuit->gates[ts->front[i]];
-        printf("    (%*zu): Virt: ", 3, ts->front[i]);
-        for (int j = 0; j < gate->num_target_qubits; j++) {
-            printf("%*d ", 3, gate->target_qubits[j]);
-        }
-        printf(" - Phys: ");
-        for (int j = 0; j < gate->num_target_qubits; j++) {
-            pqubit_t phys_qubit = layout_get_phys(ts->layout, gate->target_qubits[j]);
-            printf("%*d ", 3, phys_qubit);
-        }
-        printf(" - Cores: ");
-        for (int j = 0; j < gate->num_target_qubits; j++) {
-            pqubit_t phys_qubit = layout_get_phys(ts->layout, gate->target_qubits[j]);
-            core_t core = device->phys_to_core[phys_qubit];
-            printf("%*d ", 3, core);
-        }
-        printf("\n");
     }
 
-    if (ts->slices_outdated)
+    if (ts->slices_outdated) {
+        phase_start = monotonic_seconds();
         telesabre_slice_remaining_circuit(ts);
+        telesabre_end_phase(ts, "slicing", &ts->stats.slicing_seconds, phase_start);
+    }
     
     // Print first 3 remaining slices
-    printf(H2COL"  Remaining Slices:\n"CRESET);
-    for (int i = 0; i < ts->num_remaining_slices && i < 3; i++) {
-        size_t slice_start = ts->remaining_slices_ptr[i];
-        size_t slice_end = ts->remaining_slices_ptr[i + 1];
-        printf("    Slice %d: ", i);
-        for (size_t j = slice_start; j < slice_end; j++) {
-            printf("%zu ", ts->remaining_slices[j]);
+    if (log_enabled(LOG_DEBUG)) {
+        printf(H2COL"  Remaining Slices:\n"CRESET);
+        for (int i = 0; i < ts->num_remaining_slices && i < TS_MIN_SLICES; i++) {
+            size_t slice_start = ts->remaining_slices_ptr[i];
+            size_t slice_end = ts->remaining_slices_ptr[i + 1];
+            printf("    Slice %d: ", i);
+            for (size_t j = slice_start; j < slice_end; j++) {
+                printf("%zu ", ts->remaining_slices[j]);
+            }
+            printf("\n");
         }
-        printf("\n");
     }
 
     // Search for qubit movement operations
     int old_front_size = ts->front_size;
     if (ts->safety_valve_activated) ts->front_size = 1;
 
+    phase_start = monotonic_seconds();
     telesabre_calculate_attraction_paths(ts);
+    phase_start = telesabre_end_phase(ts, "attraction_paths", &ts->stats.attraction_paths_seconds, phase_start);
 
     telesabre_collect_traversed_comm_qubits(ts);
     telesabre_collect_nearest_free_qubits(ts);
+    phase_start = telesabre_end_phase(ts, "nearest_free_qubits", &ts->stats.candidate_collection_seconds, phase_start);
+
+    telesabre_evaluate_base_energy(ts);
+    phase_start = telesabre_end_phase(ts, "base_energy", &ts->stats.energy_evaluation_seconds, phase_start);
 
     telesabre_collect_candidate_tele_ops(ts);
     telesabre_collect_candidate_swap_ops(ts);
+    phase_start = telesabre_end_phase(ts, "candidate_collection", &ts->stats.candidate_collection_seconds, phase_start);
+    ts->stats.num_candidate_ops += ts->num_candidate_ops;
+    if (ts->num_candidate_ops > ts->stats.max_candidate_ops) ts->stats.max_candidate_ops = ts->num_candidate_ops;
+
+    telesabre_evaluate_candidate_ops(ts);
+    telesabre_end_phase(ts, "candidate_evaluation", &ts->stats.energy_evaluation_seconds, phase_start);
+
+    ts->base_energy_valid = false;
+    ts->apsp.valid = false;
+    ts->eval->use_apsp = false;
 
     ts->front_size = old_front_size;
 
     // Debug candidate op print
-    printf(H2COL"  Candidate Operations:\n"CRESET);
-    for (int i = 0; i < ts->num_candidate_ops; i++) {
-        const op_t* op = &ts->candidate_ops[i];
-        int op_qubits = op_get_num_qubits(op);
-        printf("    (%*d): Type: %s, Qubits: ", 3, i, op_get_type_str(op));
-        for (int j = 0; j < op_qubits; j++) {
-            printf("%*d", 4, op->qubits[j]);
+    if (log_enabled(LOG_TRACE)) {
+        printf(H2COL"  Candidate Operations:\n"CRESET);
+        for (int i = 0; i < ts->num_candidate_ops; i++) {
+            const op_t* op = &ts->candidate_ops[i];
+            int op_qubits = op_get_num_qubits(op);
+            printf("    (%*d): Type: %s, Qubits: ", 3, i, op_get_type_str(op));
+            for (int j = 0; j < op_qubits; j++) {
+                printf("%*d", 4, op->qubits[j]);
+            }
+            printf(", Front Gate Index: %d, Energy: %.3f, Flags: %s\n", op->front_gate_idx, ts->candidate_ops_energies[i], byte_to_binary(op->reasons));
         }
-        printf(", Front Gate Index: %d, Energy: %.3f, Flags: %s\n", op->front_gate_idx, ts->candidate_ops_energies[i], byte_to_binary(op->reasons));
-        
     }
 
     // Find operations with lowest resulting layout energy
     int num_best_operations = 0;
-    op_t* best_operations = malloc(sizeof(op_t) * ts->num_candidate_ops);
+    op_t* best_operations = ts->best_operations;
     float best_energy = TS_INF;
     for (int i = 0; i < ts->num_candidate_ops; i++) {
         if (ts->candidate_ops_energies[i] < best_energy) {
             best_energy = ts->candidate_ops_energies[i];
             best_operations[0] = ts->candidate_ops[i];
             num_best_operations = 1;
-        } else if (ts->candidate_ops_energies[i] == best_energy || fabs(ts->candidate_ops_energies[i] - best_energy) < 1e-4) {
+        } else if (ts->candidate_ops_energies[i] == best_energy || fabs(ts->candidate_ops_energies[i] - best_energy) < TS_ENERGY_TIE_TOLERANCE) {
             best_operations[num_best_operations++] = ts->candidate_ops[i];
         }
     }
 
     // Select a random operation from the best operations
     if (num_best_operations > 0) {
-        int best_op_idx = rand() % num_best_operations;
-        const op_t best_op = best_operations[best_op_idx];
-        ts->applied_op = best_op;
-        telesabre_add_report_entry(ts);
-        telesabre_apply_candidate_op(ts, &best_op);
-        ts->energy = best_energy;
+        int best_op_idx = rng_next(&ts->rng) % num_best_operations;
+        ts->applied_op = best_operations[best_op_idx];
     } else {
-        printf("    None\n");
+        log_printf(LOG_DEBUG, "    None\n");
         ts->applied_op = (op_t){0};
-        telesabre_add_report_entry(ts);
+    }
+
+    // Report entries keep a copy of the iteration, they are not part of the routing steady state
+    alloc_count_pause();
+    phase_start = monotonic_seconds();
+    telesabre_add_report_entry(ts);
+    telesabre_end_phase(ts, "report", &ts->stats.report_seconds, phase_start);
+    alloc_count_resume();
+
+    if (num_best_operations > 0) {
+        telesabre_apply_candidate_op(ts, &ts->applied_op);
+        ts->energy = best_energy;
     }
 
     telesabre_reset_usage_penalties(ts);
 
-    telesabre_step_free(ts);
+    if (ts->trace) trace_span(ts->trace, "iteration", step_start, monotonic_seconds());
 
     ts->it++;
     ts->it_without_progress++;
 }
 
 
-result_t telesabre_run(config_t* config, device_t* device, circuit_t* circuit) {
-    srand(config->seed);
+result_t telesabre_run(const config_t* config, const device_t* device, const circuit_t* circuit) {
+    return telesabre_run_cancellable(config, device, circuit, NULL);
+}
+
+
+// One line, seconds rounded to microseconds
+char* run_stats_to_json(const run_stats_t* stats) {
+    cJSON* json = cJSON_CreateObject();
+
+    cJSON* seconds = cJSON_AddObjectToObject(json, "seconds");
+    cJSON_AddNumberToObject(seconds, "gate_scan", round(stats->gate_scan_seconds * 1e6) / 1e6);
+    cJSON_AddNumberToObject(seconds, "slicing", round(stats->slicing_seconds * 1e6) / 1e6);
+    cJSON_AddNumberToObject(seconds, "attraction_paths", round(stats->attraction_paths_seconds * 1e6) / 1e6);
+    cJSON_AddNumberToObject(seconds, "candidate_collection", round(stats->candidate_collection_seconds * 1e6) / 1e6);
+    cJSON_AddNumberToObject(seconds, "energy_evaluation", round(stats->energy_evaluation_seconds * 1e6) / 1e6);
+    cJSON_AddNumberToObject(seconds, "report", round(stats->report_seconds * 1e6) / 1e6);
+
+    cJSON* counts = cJSON_AddObjectToObject(json, "counts");
+    cJSON_AddNumberToObject(counts, "iterations", stats->num_iterations);
+    cJSON_AddNumberToObject(counts, "safety_valve_iterations", stats->num_safety_valve_iterations);
+    cJSON_AddNumberToObject(counts, "dijkstra_calls", stats->num_dijkstra_calls);
+    cJSON_AddNumberToObject(counts, "apsp_lookups", stats->num_apsp_lookups);
+    cJSON_AddNumberToObject(counts, "energy_cache_hits", stats->num_energy_cache_hits);
+    cJSON_AddNumberToObject(counts, "attraction_path_reuses", stats->num_attraction_path_reuses);
+    cJSON_AddNumberToObject(counts, "layout_copies", stats->num_layout_copies);
+    cJSON_AddNumberToObject(counts, "candidate_ops", stats->num_candidate_ops);
+    cJSON_AddNumberToObject(counts, "max_candidate_ops", stats->max_candidate_ops);
+    cJSON_AddNumberToObject(counts, "top_k_cuts", stats->num_top_k_cuts);
+    cJSON_AddNumberToObject(counts, "top_k_changed", stats->num_top_k_changed);
+    cJSON_AddNumberToObject(counts, "candidate_ops_per_iteration", 
+        stats->num_iterations > 0 ? round(100.0 * stats->num_candidate_ops / stats->num_iterations) / 100 : 0.0);
+
+    char* str = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return str;
+}
+
+
+// Counters of the run and of the work the shortcuts saved
+static void telesabre_print_run_summary(const telesabre_t* ts, double elapsed) {
+    const config_t* config = ts->config;
+
+    printf(H1COL"\nTeleSABRE completed in %.3fs.\n" CRESET, elapsed);
+    printf(H1COL"Solution has %d teledata ops, %d telegate ops and %d swaps.\n" CRESET, 
+        ts->result.num_teledata, ts->result.num_telegate, ts->result.num_swaps);
+    printf(H1COL"Safety Valve activated %d times.\n" CRESET, 
+        ts->result.num_deadlocks);
+    long num_evaluations = 0, num_pruned = 0, cache_hits = 0, cache_lookups = 0;
+    for (int i = -1; i < (ts->pool ? ts->pool->num_workers : 0); i++) {
+        const eval_scratch_t* scratch = i < 0 ? ts->eval : ts->eval_workers[i];
+        num_evaluations += scratch->num_evaluations;
+        num_pruned += scratch->num_pruned;
+        if (scratch->cache) {
+            cache_hits += scratch->cache->hits;
+            cache_lookups += scratch->cache->hits + scratch->cache->misses;
+        }
+    }
+    printf(H1COL"Energy bounds stopped %ld of %ld candidate evaluations early.\n" CRESET, num_pruned, num_evaluations);
+    printf(H1COL"Merged %ld duplicate candidate operations.\n" CRESET, ts->num_merged_candidate_ops);
+    printf(H1COL"Attraction paths reused for %ld of %ld separated front gates (%.1f%%).\n" CRESET,
+        ts->num_attraction_path_reuses, ts->num_attraction_path_lookups, 
+        ts->num_attraction_path_lookups > 0 ? 100.0 * ts->num_attraction_path_reuses / ts->num_attraction_path_lookups : 0.0);
+    if (config->enable_energy_cache)
+        printf(H1COL"Path cost cache answered %ld of %ld separated gate lookups (%.1f%%).\n" CRESET, 
+            cache_hits, cache_lookups, cache_lookups > 0 ? 100.0 * cache_hits / cache_lookups : 0.0);
+    if (config->top_k_candidates > 0) {
+        printf(H1COL"Top %d screening cut candidates in %d iterations", config->top_k_candidates, ts->stats.num_top_k_cuts);
+        if (config->audit_top_k_candidates)
+            printf(", the cut changed the best candidates %d times", ts->stats.num_top_k_changed);
+        printf(".\n" CRESET);
+    }
+    printf("\n");
+}
+
+
+// Attempts running in parallel get one trace and report each, with the seed before the extension
+void telesabre_attempt_filename(const config_t* config, const char* filename, unsigned seed, char* out, size_t out_size) {
+    if (config->jobs <= 1) {
+        snprintf(out, out_size, "%s", filename);
+        return;
+    }
+    const char* ext = strrchr(filename, '.');
+    int stem_length = ext ? (int)(ext - filename) : (int)strlen(filename);
+    snprintf(out, out_size, "%.*s_%u%s", stem_length, filename, seed, ext ? ext : "");
+}
+
+
+result_t telesabre_run_cancellable(const config_t* config, const device_t* device, const circuit_t* circuit, const atomic_bool* cancel) {
     clock_t start = clock();
+    if (config->check_allocations && !alloc_count_supported())
+        error("check_allocations needs a build with -DTS_COUNT_ALLOCATIONS.");
+
     telesabre_t* ts = telesabre_init(config, device, circuit);
+    ts->cancel = cancel;
+    if (config->trace_filename[0] != '\0') {
+        char trace_filename[sizeof(config->trace_filename) + 16];
+        telesabre_attempt_filename(config, config->trace_filename, config->seed, trace_filename, sizeof(trace_filename));
+        ts->trace = trace_open(trace_filename, (int)config->seed);
+    }
 
     // TeleSABRE Main Loop
-    while (ts->front_size > 0 && ts->it < config->max_iterations) {
+    bool cancelled = false;
+    while (ts->front_size > 0 && ts->it < ts->max_iterations) {
+        if (ts->cancel && atomic_load_explicit(ts->cancel, memory_order_relaxed)) {
+            cancelled = true;
+            break;
+        }
+
+        size_t allocations = alloc_count_get();
         telesabre_step(ts);
+        if (config->check_allocations && alloc_count_get() != allocations) {
+            error("Iteration %d made %zu heap allocations.", ts->it - 1, alloc_count_get() - allocations);
+        }
     }
 
-    if (ts->it >= config->max_iterations) {
-        printf(H1COL"\nTeleSABRE reached maximum iterations (%d).\n" CRESET, config->max_iterations);
+    if (cancelled) {
+        log_printf(LOG_SUMMARY, H1COL"\nTeleSABRE cancelled at iteration %d.\n" CRESET, ts->it);
+    } else if (ts->it >= ts->max_iterations) {
+        log_printf(LOG_SUMMARY, H1COL"\nTeleSABRE reached maximum iterations (%d).\n" CRESET, ts->max_iterations);
     } else if (ts->front_size == 0) {
-        printf(H1COL"\nTeleSABRE completed all gates successfully.\n" CRESET);
+        log_printf(LOG_SUMMARY, H1COL"\nTeleSABRE completed all gates successfully.\n" CRESET);
         ts->result.success = true;
     }
 
+    for (int i = -1; i < (ts->pool ? ts->pool->num_workers : 0); i++) {
+        const eval_scratch_t* scratch = i < 0 ? ts->eval : ts->eval_workers[i];
+        ts->stats.num_dijkstra_calls += scratch->num_dijkstra_calls;
+        ts->stats.num_apsp_lookups += scratch->num_apsp_lookups;
+        ts->stats.num_layout_copies += scratch->num_layout_copies;
+        if (scratch->cache) ts->stats.num_energy_cache_hits += scratch->cache->hits;
+    }
+    ts->stats.num_attraction_path_reuses = ts->num_attraction_path_reuses;
+    ts->result.stats = ts->stats;
+
     // Final print
-    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
-    printf(H1COL"\nTeleSABRE completed in %.3fs.\n" CRESET, elapsed);
-    printf(H1COL"Solution has %d teledata ops, %d telegate ops and %d swaps.\n" CRESET, 
-        ts->result.num_teledata, ts->result.num_telegate, ts->result.num_swaps);
-    printf(H1COL"Safety Valve activated %d times.\n\n" CRESET, 
-        ts->result.num_deadlocks);
+    if (log_enabled(LOG_SUMMARY))
+        telesabre_print_run_summary(ts, (double)(clock() - start) / CLOCKS_PER_SEC);
 
+    ts->result.seed = config->seed;
     result_t result = ts->result;
 
-    if (config->save_report) {
+    if (ts->save_report && !cancelled) {
+        char report_filename[sizeof(config->report_filename) + 16];
+        telesabre_attempt_filename(config, config->report_filename, config->seed, report_filename, sizeof(report_filename));
         report_save_as_json(
             ts->report, 
             ts->config,
             ts->device,
             ts->circuit,
-            config->report_filename
+            report_filename
         );
     }
 
+    if (ts->trace) trace_close(ts->trace);
     telesabre_free(ts);
 
     return result;
@@ -1071,22 +2262,50 @@ void telesabre_free(telesabre_t* ts) {
 
     free(ts->gate_num_remaining_parents);
     free(ts->front);
+    free(ts->gate_front_pos);
+    free(ts->vqubit_front_gate);
+    free(ts->ready_gates);
+    free(ts->gate_ready_pos);
     layout_free(ts->layout);
     free(ts->usage_penalties);
     layout_free(ts->last_progress_layout);
+    free(ts->apsp.node_weights);
+    free(ts->apsp.dist);
+    free(ts->apsp.next);
+    telesabre_free_eval_scratch(ts->eval);
+    if (ts->pool) {
+        for (int i = 0; i < ts->pool->num_workers; i++)
+            telesabre_free_eval_scratch(ts->eval_workers[i]);
+        free(ts->eval_workers);
+        thread_pool_free(ts->pool);
+    }
     free(ts->candidate_ops);
     free(ts->candidate_ops_energies);
+    free(ts->candidate_ops_front_energies);
+    free(ts->best_operations);
+    free(ts->top_k_ops);
+    free(ts->candidate_op_slots);
+    free(ts->base_energy_terms);
+    free(ts->base_traffic);
+    free(ts->base_nearest_free_distances);
+    free(ts->comm_exit_costs);
+    free(ts->core_hops);
     free(ts->remaining_slices);
     free(ts->remaining_slices_ptr);
+    free(ts->slice_rem_parents);
+    free(ts->slice_stamps);
+    free(ts->slice_queue);
 
     free(ts->applied_gates);
 
-    for (int i = 0; i < ts->num_attraction_paths; i++)
-        if (ts->attraction_paths[i]) 
-            path_free(ts->attraction_paths[i]);
+    for (size_t i = 0; i < ts->attraction_paths_capacity; i++)
+        path_free(ts->attraction_paths[i]);
     
     free(ts->attraction_paths);
     free(ts->attraction_paths_front_idx);
+    for (size_t v = 0; v < ts->circuit->num_qubits; v++)
+        path_free(ts->attraction_path_cache[v].path);
+    free(ts->attraction_path_cache);
 
     free(ts->traversed_comm_qubits);
     free(ts->nearest_free_qubits);
@@ -1100,7 +2319,7 @@ void telesabre_free(telesabre_t* ts) {
 
 
 void telesabre_add_report_entry(const telesabre_t *ts) {
-    if (!ts->config->save_report) return;
+    if (!ts->save_report) return;
     report_ensure_capacity(ts->report);
 
     report_entry_t entry;
@@ -1149,9 +2368,12 @@ void telesabre_add_report_entry(const telesabre_t *ts) {
     memcpy(entry.candidate_ops, ts->candidate_ops, sizeof(op_t) * ts->num_candidate_ops);
     entry.candidate_ops_energies = malloc(sizeof(float) * ts->num_candidate_ops);
     memcpy(entry.candidate_ops_energies, ts->candidate_ops_energies, sizeof(float) * ts->num_candidate_ops);
-    // TODO
+    // Front scores are known when the candidates were screened
     entry.candidate_ops_front_energies = malloc(sizeof(float) * ts->num_candidate_ops);
-    memset(entry.candidate_ops_front_energies, 0, sizeof(float) * ts->num_candidate_ops);
+    if (ts->top_k_screened)
+        memcpy(entry.candidate_ops_front_energies, ts->candidate_ops_front_energies, sizeof(float) * ts->num_candidate_ops);
+    else
+        memset(entry.candidate_ops_front_energies, 0, sizeof(float) * ts->num_candidate_ops);
     entry.candidate_ops_future_energies = malloc(sizeof(float) * ts->num_candidate_ops);
     memset(entry.candidate_ops_future_energies, 0, sizeof(float) * ts->num_candidate_ops);
     entry.num_candidate_ops = ts->num_candidate_ops;
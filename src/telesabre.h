@@ -2,6 +2,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "config.h"
 #include "device.h"
@@ -10,7 +11,37 @@
 #include "graph.h"
 #include "op.h"
 #include "report.h"
-
+#include "thread_pool.h"
+#include "trace.h"
+
+
+#define TS_EVAL_CHUNK_SIZE 4         // Candidate ops claimed at once by an evaluation worker
+#define TS_EVAL_PARALLEL_MIN_OPS 16  // Smaller candidate sets are evaluated serially
+#define TS_MIN_SLICES 3              // Slices always materialized, the debug print shows them
+#define TS_ENERGY_TIE_TOLERANCE 1e-4 // Candidates this close to the lowest energy are tied with it
+#define TS_ENERGY_PRUNE_MARGIN 1e-3  // Candidate evaluation stops once the energy exceeds the best by this
+#define TS_ENERGY_CACHE_ENTRIES 4096 // Path costs kept per evaluator, a power of two
+
+// Wall time of each phase of the routing loop and counts of the work done in it
+typedef struct run_stats {
+    double gate_scan_seconds;            // Executing the ready front gates
+    double slicing_seconds;
+    double attraction_paths_seconds;
+    double candidate_collection_seconds; // Traversed comm qubits, nearest free qubits and candidate ops
+    double energy_evaluation_seconds;    // Base energy and candidate ops, wall time over all threads
+    double report_seconds;
+    long num_iterations;
+    long num_safety_valve_iterations;
+    long num_dijkstra_calls;             // Pair paths searched on a freshly built contracted graph
+    long num_apsp_lookups;               // Pair paths read from the all-pairs tables instead
+    long num_energy_cache_hits;          // Separated gate path costs answered by the energy cache
+    long num_attraction_path_reuses;     // Attraction paths kept from the previous iteration
+    long num_layout_copies;
+    long num_candidate_ops;
+    int max_candidate_ops;
+    int num_top_k_cuts;                  // Iterations where top-k screening left candidates out
+    int num_top_k_changed;               // Of those, iterations where a left out candidate was, or tied with, the best (audit only)
+} run_stats_t;
 
 typedef struct result {
     int num_teledata;
@@ -19,15 +50,131 @@ typedef struct result {
     int depth;
     int num_deadlocks;
     bool success;
+    unsigned seed;
+    run_stats_t stats;
 } result_t;
 
 typedef struct {
-    device_t* device;
-    circuit_t* circuit;
-    config_t* config;
+    edge_t* edge;
+    int weight;  // Weight before the patch
+} edge_patch_t;
+
+// Comm qubit graph built once per run. Pair queries only overlay the gate 
+// qubit nodes, node weights and traffic on top of the static skeleton.
+typedef struct {
+    graph_t* graph;
+    size_t* skeleton_degrees;
+    edge_patch_t* traffic_patches;
+    size_t num_traffic_patches;
+    size_t traffic_patches_capacity;
+} contracted_graph_t;
+
+// All-pairs shortest paths between comm qubit nodes for the node weights of a layout.
+// dist[i][j] includes the weights of the nodes after i, up to j.
+typedef struct {
+    int* node_weights;
+    int* dist;
+    int* next;
+    bool valid;
+    unsigned epoch;  // Incremented whenever the tables change, 0 before the first build
+    uint64_t weights_key;  // Order independent hash of node_weights, kept for the energy cache
+} comm_apsp_t;
+
+// Attraction path of a front gate, kept across iterations while the gate qubits stay 
+// in place and the all-pairs tables it was read from do not change
+typedef struct {
+    size_t gate_id;  // -1 for an empty entry
+    pqubit_t p1;
+    pqubit_t p2;
+    unsigned apsp_epoch;
+    path_t* path;
+} attraction_path_cache_t;
+
+// Path cost of a separated gate. It depends on the gate qubit positions, the comm node weights 
+// (nearest free distances and core capacities) and the traffic of the paths evaluated before it. 
+// Entries keep all comm node weights and the sorted directed traffic edges, and stay valid across iterations
+// until one of them changes.
+#define TS_ENERGY_CACHE_MAX_TRAFFIC 64  // Longer traffic is not cached
+
+typedef struct {
+    uint64_t key;          // Hash of the weights, the traffic and the fields below, 0 for an empty slot
+    int traffic_length;
+    pqubit_t p1;
+    pqubit_t p2;
+    bool apsp;             // Answered from the all-pairs tables, which may pick another tied path
+    int energy;
+    int path_length;
+} energy_cache_entry_t;
+
+// Direct mapped, a new path cost replaces the one in its slot
+typedef struct {
+    energy_cache_entry_t* entries;
+    node_t* paths;         // path_capacity nodes per entry
+    size_t path_capacity;
+    int* node_weights;     // num_nodes comm node weights per entry
+    int num_nodes;
+    uint32_t* traffic;     // TS_ENERGY_CACHE_MAX_TRAFFIC edge codes per entry
+    long hits;
+    long misses;
+} energy_cache_t;
+
+// Mutable state of one energy evaluator. Candidate ops are applied to the 
+// layout and undone, so each thread evaluates on its own scratch.
+typedef struct {
+    layout_t* layout;
+    bool owns_layout;  // Worker copy, otherwise aliases the run layout
+    layout_undo_t* undo;
+    contracted_graph_t* contracted_graph;
+    bool use_apsp;     // Node weights of the layout match the apsp tables
+    int (*traffic)[3];
+    size_t traffic_capacity;
+    dijkstra_scratch_t* dijkstra;
+    path_t* path;
+    long num_evaluations;  // Candidate evaluations, and those stopped early by the budget
+    long num_pruned;
+    long num_dijkstra_calls;
+    long num_apsp_lookups;
+    long num_layout_copies;
+    energy_cache_t* cache;  // NULL if disabled
+    // Cache keys of the layout under evaluation, set when a move is applied
+    int* node_weights;        // Comm node weights, those of the run layout updated for the moved cores
+    uint64_t weights_key;
+    uint32_t* traffic_edges;  // Sorted edge codes of the traffic seen so far
+    int traffic_length;       // -1 once the traffic is too long to cache
+    size_t traffic_key_size;  // Traffic entries folded into traffic_edges
+    uint64_t traffic_key;
+} eval_scratch_t;
+
+// Contribution of one gate to the energy of a layout
+typedef struct {
+    size_t gate_id;
+    int energy;
+    bool is_front;
+    bool separated;
+    size_t traffic_start;  // Traffic entries added by this gate's path
+    size_t traffic_end;
+} energy_term_t;
+
+typedef struct {
+    const device_t* device;
+    const circuit_t* circuit;
+    const config_t* config;
+
+    rng_t rng;            // Tie breaks and initial layout, seeded from config->seed
+    int max_iterations;   // Limits of this run, tightened by the safety valve
+    bool save_report;
+
+    size_t max_front_paths;  // Buffer limits derived from device and circuit
+    size_t max_path_length;
+    size_t max_traffic;
 
     layout_t* layout;
     layout_t* last_progress_layout;
+    comm_apsp_t apsp;
+
+    eval_scratch_t* eval;           // Evaluator on the run layout
+    eval_scratch_t** eval_workers;  // One per pool worker, worker 0 is the calling thread
+    thread_pool_t* pool;
 
     float* usage_penalties;
     int usage_penalties_reset_counter;
@@ -36,19 +183,46 @@ typedef struct {
     size_t* front;
     size_t front_size;
     size_t front_capacity;
+    size_t* gate_front_pos;     // Index in front of each front gate
+    size_t* vqubit_front_gate;  // Front gate acting on each virtual qubit, or -1
+    size_t* ready_gates;        // Front gates executable in the current layout
+    size_t num_ready_gates;
+    size_t* gate_ready_pos;     // Index in ready_gates, or -1
 
     size_t *remaining_slices; // CSR
     size_t *remaining_slices_ptr;
-    size_t num_remaining_slices;
+    size_t num_remaining_slices;  // Materialized slices, up to the energy horizon
+    size_t *slice_rem_parents;    // Slicing scratch, valid where slice_stamps matches slice_epoch
+    unsigned *slice_stamps;
+    unsigned slice_epoch;
+    size_t *slice_queue;
     bool slices_outdated;
+    size_t num_remaining_gates;
 
     int *applied_gates;
     int num_applied_gates;
 
     op_t* candidate_ops;
     float* candidate_ops_energies;
+    float* candidate_ops_front_energies;  // Front only scores, when the candidates were screened
+    op_t* best_operations;
+    int* top_k_ops;
+    bool top_k_screened;
     int num_candidate_ops;
     int candidate_ops_capacity;
+    int* candidate_op_slots;  // Open addressing set of candidate op ids by (type, qubits), -1 if empty
+    size_t candidate_op_slots_mask;
+    long num_merged_candidate_ops;
+
+    energy_term_t* base_energy_terms;  // Energy terms of the current layout, used for delta evaluation
+    size_t num_base_energy_terms;
+    int (*base_traffic)[3];
+    size_t base_traffic_capacity;
+    int* base_nearest_free_distances;
+    bool base_energy_valid;
+
+    int* comm_exit_costs;  // Lowest abs(distance - 1) from each qubit to a comm qubit of its core
+    int* core_hops;        // Inter-core edges on a shortest route between two cores, TS_INF if none
 
     int it;
     int it_without_progress;
@@ -58,6 +232,9 @@ typedef struct {
     int *attraction_paths_front_idx;
     size_t num_attraction_paths;
     size_t attraction_paths_capacity;
+    attraction_path_cache_t* attraction_path_cache;  // By first virtual qubit of the gate, front gates are disjoint
+    long num_attraction_path_reuses;
+    long num_attraction_path_lookups;
 
     pqubit_t* traversed_comm_qubits;
     size_t num_traversed_comm_qubits;
@@ -72,18 +249,30 @@ typedef struct {
 
     result_t last_progress_result;
     result_t result;
+    run_stats_t stats;  // Kept apart from result, which the safety valve rolls back
 
     report_t* report;
+    trace_t* trace;  // NULL unless tracing
+
+    const atomic_bool* cancel;  // Set by another thread to stop the run early
 } telesabre_t;
 
-result_t telesabre_run(config_t* config, device_t* device, circuit_t* circuit);
+result_t telesabre_run(const config_t* config, const device_t* device, const circuit_t* circuit);
+
+char* run_stats_to_json(const run_stats_t* stats);
 
-telesabre_t* telesabre_init(config_t* config, device_t* device, circuit_t* circuit);
+void telesabre_attempt_filename(const config_t* config, const char* filename, unsigned seed, char* out, size_t out_size);
+
+result_t telesabre_run_cancellable(const config_t* config, const device_t* device, const circuit_t* circuit, const atomic_bool* cancel);
+
+telesabre_t* telesabre_init(const config_t* config, const device_t* device, const circuit_t* circuit);
 
 void telesabre_step(telesabre_t* ts);
 
 void telesabre_safety_valve_check(telesabre_t* ts);
 void telesabre_execute_front_gate(telesabre_t* ts, size_t front_gate_idx);
+
+void telesabre_update_ready_gates(telesabre_t* ts, const pqubit_t* phys, int num_phys);
 void telesabre_made_progress(telesabre_t* ts);
 
 void telesabre_calculate_attraction_paths(telesabre_t* ts);
@@ -92,9 +281,19 @@ void telesabre_collect_nearest_free_qubits(telesabre_t* ts);
 
 void telesabre_slice_remaining_circuit(telesabre_t* ts);
 
-float telesabre_evaluate_op_energy(telesabre_t* ts, const op_t* op);
+eval_scratch_t* telesabre_new_eval_scratch(const telesabre_t* ts, bool own_layout);
+
+void telesabre_free_eval_scratch(eval_scratch_t* scratch);
+
+float telesabre_evaluate_op_energy(const telesabre_t* ts, eval_scratch_t* scratch, const op_t* op, bool front_only, float budget);
+
+void telesabre_evaluate_base_energy(telesabre_t* ts);
+
+float telesabre_evaluate_swap_energy_delta(const telesabre_t* ts, eval_scratch_t* scratch, const op_t* op, bool front_only, float budget);
 
 void telesabre_add_candidate_op(telesabre_t* ts, const op_t* op);
+void telesabre_evaluate_candidate_ops(telesabre_t* ts);
+void telesabre_clear_candidate_ops(telesabre_t* ts);
 void telesabre_collect_candidate_tele_ops(telesabre_t* ts);
 void telesabre_collect_candidate_swap_ops(telesabre_t* ts);
 
@@ -102,8 +301,17 @@ void telesabre_apply_candidate_op(telesabre_t* ts, const op_t* op);
 
 void telesabre_reset_usage_penalties(telesabre_t* ts);
 
+contracted_graph_t* telesabre_new_contracted_graph(const telesabre_t* ts);
+
+void telesabre_free_contracted_graph(contracted_graph_t* cg);
+
+void telesabre_update_comm_apsp(telesabre_t* ts);
+
+void telesabre_find_pair_path(const telesabre_t* ts, eval_scratch_t* scratch, const gate_t* gate, const int traffic[][3], size_t num_traffic, pqubit_t node_id_to_phys_out[2], path_t* path_out);
+
 graph_t* telesabre_build_contracted_graph_for_pair(
     const telesabre_t* ts,
+    contracted_graph_t* cg,
     const layout_t* layout,
     const gate_t* gate, 
     size_t node_ids_out[2],
@@ -114,8 +322,6 @@ graph_t* telesabre_build_contracted_graph_for_pair(
 
 void telesabre_add_report_entry(const telesabre_t* ts);
 
-void telesabre_step_free(telesabre_t* ts);
-
 void telesabre_free(telesabre_t* ts);
 
 result_t run_telesabre(device_t* device, circuit_t* circuit, config_t* config_t);
\ No newline at end of file
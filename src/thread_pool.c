@@ -0,0 +1,111 @@
+#include "thread_pool.h"
+
+#include <stdlib.h>
+
+#include "utils.h"
+
+
+struct thread_pool_worker {
+    thread_pool_t* pool;
+    int id;
+};
+
+
+static void* thread_pool_worker_main(void* arg) {
+    struct thread_pool_worker* worker = arg;
+    thread_pool_t* pool = worker->pool;
+    unsigned long seen_generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->shutdown && pool->generation == seen_generation)
+            pthread_cond_wait(&pool->task_ready, &pool->mutex);
+        if (pool->shutdown) break;
+
+        seen_generation = pool->generation;
+        thread_pool_task_t task = pool->task;
+        void* task_arg = pool->task_arg;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task(task_arg, worker->id);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->num_running == 0)
+            pthread_cond_signal(&pool->task_done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+
+thread_pool_t* thread_pool_new(int num_workers) {
+    if (num_workers < 1) num_workers = 1;
+
+    thread_pool_t* pool = malloc(sizeof(thread_pool_t));
+    pool->threads = malloc(sizeof(pthread_t) * num_workers);
+    pool->workers = malloc(sizeof(struct thread_pool_worker) * num_workers);
+    check_alloc(3, pool, pool->threads, pool->workers);
+
+    pool->num_workers = num_workers;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->task_done, NULL);
+    pool->task = NULL;
+    pool->task_arg = NULL;
+    pool->generation = 0;
+    pool->num_running = 0;
+    pool->shutdown = false;
+
+    // Worker 0 is the thread calling thread_pool_run
+    for (int i = 1; i < num_workers; i++) {
+        pool->workers[i] = (struct thread_pool_worker){.pool = pool, .id = i};
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker_main, &pool->workers[i]) != 0)
+            error("Failed to create worker thread.");
+    }
+
+    return pool;
+}
+
+
+void thread_pool_run(thread_pool_t* pool, thread_pool_task_t task, void* arg) {
+    if (pool->num_workers == 1) {
+        task(arg, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->task_arg = arg;
+    pool->num_running = pool->num_workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    task(arg, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->num_running > 0)
+        pthread_cond_wait(&pool->task_done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+
+void thread_pool_free(thread_pool_t* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->num_workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->task_done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
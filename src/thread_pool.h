@@ -0,0 +1,31 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+
+typedef void (*thread_pool_task_t)(void* arg, int worker_id);
+
+// Persistent workers running one task at a time. The calling thread 
+// takes part in every run as worker 0.
+typedef struct {
+    pthread_t* threads;
+    struct thread_pool_worker* workers;
+    int num_workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t task_ready;
+    pthread_cond_t task_done;
+
+    thread_pool_task_t task;
+    void* task_arg;
+    unsigned long generation;
+    int num_running;
+    bool shutdown;
+} thread_pool_t;
+
+thread_pool_t* thread_pool_new(int num_workers);
+
+void thread_pool_run(thread_pool_t* pool, thread_pool_task_t task, void* arg);
+
+void thread_pool_free(thread_pool_t* pool);
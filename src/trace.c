@@ -0,0 +1,89 @@
+#include "trace.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+
+trace_t *trace_open(const char *filename, int pid) {
+    trace_t *trace = malloc(sizeof(trace_t));
+    check_alloc(1, trace);
+    trace->file = fopen(filename, "w");
+    if (trace->file == NULL)
+        error("Could not open trace file %s.", filename);
+    // Writes are already buffered here
+    setvbuf(trace->file, NULL, _IONBF, 0);
+    trace->buffer = malloc(TRACE_BUFFER_SIZE);
+    check_alloc(1, trace->buffer);
+    trace->origin = monotonic_seconds();
+    trace->pid = pid;
+    trace->empty = true;
+    trace->size = (size_t)snprintf(trace->buffer, TRACE_BUFFER_SIZE, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    return trace;
+}
+
+
+static void trace_flush(trace_t *trace) {
+    if (trace->size > 0 && fwrite(trace->buffer, 1, trace->size, trace->file) != trace->size)
+        error("Could not write trace file.");
+    trace->size = 0;
+}
+
+
+// Room for one event, separated from the previous one
+static char *trace_reserve(trace_t *trace) {
+    if (trace->size + TRACE_MAX_EVENT_SIZE + 2 > TRACE_BUFFER_SIZE)
+        trace_flush(trace);
+    if (!trace->empty) {
+        trace->buffer[trace->size++] = ',';
+        trace->buffer[trace->size++] = '\n';
+    }
+    trace->empty = false;
+    return trace->buffer + trace->size;
+}
+
+
+static void trace_commit(trace_t *trace, int length) {
+    trace->size += length < TRACE_MAX_EVENT_SIZE ? (size_t)length : TRACE_MAX_EVENT_SIZE - 1;
+}
+
+
+void trace_span(trace_t *trace, const char *name, double start, double end) {
+    char *out = trace_reserve(trace);
+    int length = snprintf(out, TRACE_MAX_EVENT_SIZE, 
+        "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": 1}",
+        name, (start - trace->origin) * 1e6, (end - start) * 1e6, trace->pid);
+    trace_commit(trace, length);
+}
+
+
+void trace_instant(trace_t *trace, const char *name, double time, const char *args_fmt, ...) {
+    char *out = trace_reserve(trace);
+    int length = snprintf(out, TRACE_MAX_EVENT_SIZE, 
+        "{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": 1, \"args\": {",
+        name, (time - trace->origin) * 1e6, trace->pid);
+    if (length < TRACE_MAX_EVENT_SIZE - 3) {
+        va_list args;
+        va_start(args, args_fmt);
+        length += vsnprintf(out + length, TRACE_MAX_EVENT_SIZE - 3 - length, args_fmt, args);
+        va_end(args);
+    }
+    if (length > TRACE_MAX_EVENT_SIZE - 3) length = TRACE_MAX_EVENT_SIZE - 3;
+    out[length++] = '}';
+    out[length++] = '}';
+    trace_commit(trace, length);
+}
+
+
+void trace_close(trace_t *trace) {
+    if (trace->size + 4 > TRACE_BUFFER_SIZE)
+        trace_flush(trace);
+    trace->size += (size_t)snprintf(trace->buffer + trace->size, 4, "\n]}");
+    trace_flush(trace);
+    fclose(trace->file);
+    free(trace->buffer);
+    free(trace);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+
+#define TRACE_BUFFER_SIZE (1 << 16)
+#define TRACE_MAX_EVENT_SIZE 512  // Longer events are cut
+
+// Chrome trace event JSON writer, opened with Perfetto or chrome://tracing.
+// Events are formatted into a buffer that is written out when nearly full.
+typedef struct trace {
+    FILE *file;
+    char *buffer;
+    size_t size;
+    double origin;  // monotonic_seconds() at open, event times are relative to it
+    int pid;
+    bool empty;
+} trace_t;
+
+
+trace_t *trace_open(const char *filename, int pid);
+
+// Times are monotonic_seconds() values
+void trace_span(trace_t *trace, const char *name, double start, double end);
+
+// Args are the members of a JSON object, e.g. "\"iteration\": %d"
+void trace_instant(trace_t *trace, const char *name, double time, const char *args_fmt, ...);
+
+void trace_close(trace_t *trace);
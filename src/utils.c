@@ -4,15 +4,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
-void fisher_yates(void *arr, size_t n, size_t elem_size) {
+// splitmix64 finalizer
+uint64_t hash_u64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+
+double monotonic_seconds() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+void rng_seed(rng_t *rng, unsigned seed) {
+    int32_t word = seed == 0 ? 1 : (int32_t)seed;
+    rng->state[0] = (uint32_t)word;
+    for (int i = 1; i < 31; i++) {
+        // 16807 * word % (2^31 - 1) without overflow
+        int32_t hi = word / 127773;
+        int32_t lo = word % 127773;
+        word = 16807 * lo - 2836 * hi;
+        if (word < 0) word += 2147483647;
+        rng->state[i] = (uint32_t)word;
+    }
+
+    // Position 34 of the sequence, entries 31..33 repeat 0..2
+    rng->index = 34 % 31;
+    for (int i = 0; i < 310; i++) rng_next(rng);
+}
+
+
+int rng_next(rng_t *rng) {
+    // r[i] = r[i - 31] + r[i - 3], the slot of r[i - 31] is reused for r[i]
+    uint32_t *r = &rng->state[rng->index];
+    *r += rng->state[(rng->index + 28) % 31];
+    int result = (int)(*r >> 1);
+    rng->index = (rng->index + 1) % 31;
+    return result;
+}
+
+
+void fisher_yates(void *arr, size_t n, size_t elem_size, rng_t *rng) {
     char *a = (char *)arr;
     void *tmp = malloc(elem_size);
     if (!tmp) return;
 
     for (size_t i = n - 1; i > 0; i--) {
-        size_t j = rand() % (i + 1);
+        size_t j = rng_next(rng) % (i + 1);
         memcpy(tmp, a + i * elem_size, elem_size);
         memcpy(a + i * elem_size, a + j * elem_size, elem_size);
         memcpy(a + j * elem_size, tmp, elem_size);
@@ -21,31 +68,6 @@ void fisher_yates(void *arr, size_t n, size_t elem_size) {
 }
 
 
-int **floyd_warshall(int num_nodes, int edges[][3], int num_edges) {
-    int **dist = (int **)malloc(num_nodes * sizeof(int *));
-    for (int i = 0; i < num_nodes; ++i) {
-        dist[i] = (int *)malloc(num_nodes * sizeof(int));
-        for (int j = 0; j < num_nodes; ++j) dist[i][j] = (i == j) ? 0 : TS_INF;
-    }
-
-    for (int e = 0; e < num_edges; ++e) {
-        int u = edges[e][0];
-        int v = edges[e][1];
-        int w = edges[e][2];
-        dist[u][v] = w;
-        dist[v][u] = w;
-    }
-
-    // Floyd-Warshall
-    for (int k = 0; k < num_nodes; ++k)
-        for (int i = 0; i < num_nodes; ++i)
-            for (int j = 0; j < num_nodes; ++j)
-                if (dist[i][j] > dist[i][k] + dist[k][j]) dist[i][j] = dist[i][k] + dist[k][j];
-
-    return dist;
-}
-
-
 void error_impl(const char *file, int line, const char *msg, ...) {
     fprintf(stderr, "[%s:%d] ", file, line);
     va_list args;
@@ -58,24 +80,24 @@ void error_impl(const char *file, int line, const char *msg, ...) {
 
 
 void check_alloc_impl(const char *file, int line, int num_ptrs, ...) {
+    // Called on every allocation, scans the arguments without allocating
     va_list args;
     va_start(args, num_ptrs);
-    void **ptrs = malloc(num_ptrs * sizeof(void *));
     int null_found = 0;
     for (int i = 0; i < num_ptrs; ++i) {
-        ptrs[i] = va_arg(args, void *);
-        if (ptrs[i] == NULL) null_found = 1;
+        if (va_arg(args, void *) == NULL) null_found = 1;
     }
     va_end(args);
 
     if (null_found) {
+        va_start(args, num_ptrs);
         for (int i = 0; i < num_ptrs; ++i) {
-            if (ptrs[i]) free(ptrs[i]);
+            void *ptr = va_arg(args, void *);
+            if (ptr) free(ptr);
         }
-        free(ptrs);
+        va_end(args);
         error_impl(file, line, "Failed to allocate memory.");
     }
-    free(ptrs);
 }
 
 size_t realloc_grow(void *ptr, size_t unit, size_t old_size, size_t new_size) {
@@ -89,7 +111,7 @@ size_t realloc_grow(void *ptr, size_t unit, size_t old_size, size_t new_size) {
 
 
 const char *byte_to_binary(unsigned char x) {
-    static char b[9];
+    static _Thread_local char b[9];  // Per thread, parallel attempts print concurrently
     b[0] = '\0';
 
     int z;
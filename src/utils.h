@@ -3,6 +3,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 
@@ -16,9 +17,22 @@ void check_alloc_impl(const char *file, int line, int num_ptrs, ...);
 
 void check_realloc(void *ptr, size_t unit, size_t old_size, size_t new_size);
 
-void fisher_yates(void *arr, size_t n, size_t elem_size);
+// Per-run random state. Same additive feedback generator as glibc 
+// srand()/rand(), so a seed gives the same sequence as the global one.
+typedef struct {
+    uint32_t state[31];
+    int index;
+} rng_t;
 
-int **floyd_warshall(int num_nodes, int edges[][3], int num_edges);
+void rng_seed(rng_t *rng, unsigned seed);
+
+int rng_next(rng_t *rng);
+
+uint64_t hash_u64(uint64_t x);
+
+double monotonic_seconds();
+
+void fisher_yates(void *arr, size_t n, size_t elem_size, rng_t *rng);
 
 const char *byte_to_binary(unsigned char x);
 